@@ -0,0 +1,22 @@
+/* 
+ * File:   clock.h
+ * Author: Jack
+ * Comments: Uptime from TMR1 overflows, 131.072ms each (PS8 at 16MHz).
+ * Revision history: 
+ */
+
+#ifndef CLOCK_H
+#define	CLOCK_H
+
+#define TMR1_HZ 500000UL        // Fosc/4 with PS8
+
+extern unsigned long clock_overflows;
+
+void init_clock(char);
+unsigned long read_clock_overflows(void);
+unsigned long read_clock_ticks(void);
+unsigned short read_TMR1(void);
+unsigned short clock_seconds(void);
+unsigned short clock_deciseconds(void);
+
+#endif
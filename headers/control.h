@@ -0,0 +1,43 @@
+/*
+ * File:   control.h
+ * Author: Jack
+ * Comments: The line follower's sensing and control law, everything from an
+ *           IR sample to the wheel duties, kept free of registers so the
+ *           host simulator runs the same code on each robot through ROBOT.
+ *           main.c reads the ADC, encoders and clock, and applies the
+ *           duties to the motors.
+ * Revision history:
+ */
+
+#ifndef CONTROL_H
+#define	CONTROL_H
+
+#include <ir_sensors.h>
+
+#define ADC_CUTOFF 3500     // reading at and above which a sensor sees line
+
+// Control features as built
+#define HEADING_HOLD 1      // 1 trims wheel duty while the line is centered
+#define POSITION_HOLD 0     // 1 servos the wheels in place while paused
+#define SPEED_PROFILE 0     // 1 follows the speed planned for the route
+#define LOSS_PREDICT 1      // 1 slows and steers harder before losing the line
+#define LOSS_HORIZON_MS 150 // how far ahead a line loss counts as imminent
+#define LATENCY_COMP 0      // 1 steers for the line offset predicted ahead,
+                            // once the geometry and motor lag are measured
+#define FRAME_COMP 0        // 1 moves each IR sample to the newest one's moment,
+                            // once the geometry in line_offset.h is measured
+
+// What control_step() wants done with the motors
+#define CONTROL_FOLLOW 0    // following the line, drive at the duties
+#define CONTROL_LOST 1      // no usable pattern, leave the motors as they are
+#define CONTROL_MARKER 2    // on the stop marker, drive at the duties
+#define CONTROL_DRIVE 3     // holding position or docking, drive at the duties
+#define CONTROL_BRAKE 4     // docked or docking failed, stop
+
+void init_control(void);
+void start_control(char, int, int);
+void control_sample(struct IRSensor *, short, unsigned long, int, int);
+char control_step(unsigned long, int, int, signed char *, signed char *);
+unsigned short control_period(int);
+
+#endif
@@ -0,0 +1,59 @@
+/* 
+ * File:   coroutine.h
+ * Author: Jack
+ * Comments: Stackless coroutines for sequenced behaviors, in the style of
+ *           protothreads. A sequence is written as straight line code that
+ *           waits with CO_SLEEP_MS or CO_WAIT_UNTIL, and each wait returns
+ *           to the scheduler instead of spinning in __delay_ms, so sensing
+ *           and control keep running. The resume point is kept as a line
+ *           number in struct Coroutine and jumped to by a switch, so no
+ *           stack is needed. Locals do not survive a wait: keep loop
+ *           counters in count, and never put two waits on one line.
+ * Revision history: 
+ */
+
+#ifndef COROUTINE_H
+#define	COROUTINE_H
+
+#define CO_WAITING 0            // blocked on a wait, step again later
+#define CO_DONE 1               // ran to the end
+
+struct Coroutine
+{
+    char (*run)(struct Coroutine *);    // sequence stepped, 0 when idle
+    unsigned short line;        // resume point, 0 at the start
+    unsigned long wake_ticks;   // clock that ends a CO_SLEEP_MS
+    unsigned char count;        // loop counter kept across waits
+};
+
+#define CO_BEGIN(co) switch ((co)->line) { case 0:
+
+#define CO_END(co) } (co)->line = 0; return CO_DONE
+
+#define CO_WAIT_UNTIL(co, condition) do { \
+    (co)->line = __LINE__; \
+    case __LINE__: \
+    if (!(condition)) { \
+        return CO_WAITING; \
+    } \
+} while (0)
+
+#define CO_SLEEP_MS(co, ms) do { \
+    coroutine_sleep(co, ms); \
+    CO_WAIT_UNTIL(co, coroutine_woken(co)); \
+} while (0)
+
+// Runs another sequence to its end from its start, child is its own Coroutine
+#define CO_CALL(co, child, sequence) do { \
+    (child)->line = 0; \
+    (child)->count = 0; \
+    CO_WAIT_UNTIL(co, (sequence)(child) == CO_DONE); \
+} while (0)
+
+void start_coroutine(struct Coroutine *, char (*)(struct Coroutine *));
+void stop_coroutine(struct Coroutine *);
+char step_coroutine(struct Coroutine *);
+void coroutine_sleep(struct Coroutine *, unsigned short);
+char coroutine_woken(const struct Coroutine *);
+
+#endif
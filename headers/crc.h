@@ -0,0 +1,15 @@
+/* 
+ * File:   crc.h
+ * Author: Jack
+ * Comments: CRC-8 (poly 0x07) shared by the firmware and the host tools.
+ * Revision history: 
+ */
+
+#ifndef CRC_H
+#define	CRC_H
+
+unsigned char crc8(const unsigned char *, unsigned char);
+unsigned char crc8_continue(unsigned char, const unsigned char *, 
+        unsigned char);
+
+#endif
@@ -0,0 +1,47 @@
+/* 
+ * File:   delivery_log.h
+ * Author: Jack
+ * Comments: Per-delivery statistics kept as a circular log in data EEPROM.
+ *           Records are little endian and decoded by tools/decode_log.c.
+ * Revision history: 
+ */
+
+#ifndef DELIVERY_LOG_H
+#define	DELIVERY_LOG_H
+
+#include <xc.h>
+
+// Abort reasons
+#define LOG_COMPLETED 0         // stop marker reached
+#define LOG_LINE_LOST 1         // line lost for too long
+#define LOG_DOCK_FAILED 2       // stop point not reached in time
+
+#define LOG_RECORD_SIZE 16
+#define LOG_RECORDS 64          // 1024 bytes of data EEPROM
+
+struct DeliveryRecord
+{
+    unsigned short sequence;        // 0xFFFF marks an erased slot
+    unsigned short start_time;      // s since power up
+    unsigned short end_time;        // s since power up
+    unsigned short distance;        // cm
+    unsigned char lost_events;
+    unsigned short recovery_time;   // 0.1s spent with the line lost
+    unsigned short pause_time;      // 0.1s spent paused
+    unsigned char battery_min;      // 50mV
+    unsigned char abort_reason;
+    unsigned char crc;              // CRC-8 of the fields above
+};
+
+void init_delivery_log(char);
+void start_delivery_stats(int, int);
+void pause_delivery_stats(void);
+void resume_delivery_stats(void);
+void update_delivery_stats(char);
+void update_battery_stats(short);
+void finish_delivery_stats(char, int, int);
+char delivery_stats_active(void);
+unsigned char delivery_stats_crc(unsigned char);
+void dump_delivery_log(void);
+
+#endif
@@ -0,0 +1,38 @@
+/* 
+ * File:   docking.h
+ * Author: Jack
+ * Comments: Stops a set encoder distance past the leading edge of the stop
+ *           marker along a constant deceleration profile, or gives up if
+ *           that takes too long.
+ * Revision history: 
+ */
+
+#ifndef DOCKING_H
+#define	DOCKING_H
+
+#define DOCK_IDLE 0             // looking for the marker
+#define DOCK_ARMED 1            // leading edge seen, confirming the marker
+#define DOCK_ACTIVE 2           // decelerating to the stop point
+#define DOCK_DONE 3             // stopped at the stop point
+#define DOCK_FAILED 4           // out of time before reaching it
+
+#define CRUISE_DUTY 25          // duty cycle of the line center pattern
+#define CRUISE_SPEED 250        // mm/s reached at CRUISE_DUTY
+
+struct Docking
+{
+    char state;
+    int marker_right;           // encoder counts at the leading edge
+    int marker_left;
+    int still_right;            // encoder counts when last seen moving
+    int still_left;
+    char still_steps;           // control steps since then
+    unsigned char steps;        // control steps since the marker was confirmed
+    int push;                   // duty from the stall integral, x DOCK_KI_DIV
+};
+
+void reset_docking(struct Docking *);
+void update_dock_marker(struct Docking *, char, int, int);
+signed char docking_duty(struct Docking *, int, int, int);
+
+#endif
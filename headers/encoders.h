@@ -8,7 +8,15 @@
 #ifndef ENCODERS_H
 #define	ENCODERS_H
 
-#include <xc.h> 
+// Odometry, counts are always in x4 decoded units. Both are placeholders
+// until measured on the robot, every distance in mm scales with them
+#define COUNTS_PER_REV 360      // encoder counts per wheel revolution
+#define WHEEL_TRAVEL_MM 100     // distance covered per wheel revolution
+
+// Decode resolutions, counts stay in x4 units in every mode
+#define ENCODER_X4 0            // every edge of both channels
+#define ENCODER_X2 1            // every edge of channel A
+#define ENCODER_X1 2            // rising edges of channel A
 
 struct Encoder 
 {
@@ -23,6 +31,8 @@ struct Encoder
 struct Encoder init_encoder(char, char);
 void start_encoders(void);
 void stop_encoders(void);
+void set_encoder_mode(char);
+char select_encoder_mode(char, int);
 
 #endif
 
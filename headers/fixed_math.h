@@ -0,0 +1,14 @@
+/* 
+ * File:   fixed_math.h
+ * Author: Jack
+ * Comments: Integer helpers shared by the estimators and controllers.
+ * Revision history: 
+ */
+
+#ifndef FIXED_MATH_H
+#define	FIXED_MATH_H
+
+unsigned short square_root(unsigned long);
+signed char sine(unsigned char);
+
+#endif
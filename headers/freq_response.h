@@ -0,0 +1,52 @@
+/* 
+ * File:   freq_response.h
+ * Author: Jack
+ * Comments: Frequency response test of the steering loop. A sine is added
+ *           to the steering command at each frequency in turn while the
+ *           robot follows the line, and the steering and line offset are
+ *           correlated with it on the robot. Each finished frequency is
+ *           reported over the UART for tools/freq_response.c.
+ * Revision history: 
+ */
+
+#ifndef FREQ_RESPONSE_H
+#define	FREQ_RESPONSE_H
+
+#define FREQ_POINTS 10          // frequencies in the sweep
+#define FREQ_AMPLITUDE 6        // duty added to one wheel, taken off the other
+#define FREQ_SETTLE_CYCLES 2    // cycles run before measuring each frequency
+#define FREQ_MEASURE_CYCLES 4   // whole cycles measured at each frequency
+#define FREQ_CYCLE 50000000UL   // phase per cycle, centi-Hz x TMR1 ticks
+
+// Sums of each signal times the sine and cosine of the perturbation
+struct FreqPoint
+{
+    unsigned short centihz;
+    unsigned short samples;
+    long u_sin;                 // steering applied, controller plus sine
+    long u_cos;
+    long c_sin;                 // the controller's own steering
+    long c_cos;
+    long y_sin;                 // line offset, see line_offset.h
+    long y_cos;
+};
+
+struct FreqResponse
+{
+    char active;
+    char ready;                 // result holds a point not yet reported
+    char point;                 // frequency being run
+    char cycles;                // cycles completed at this frequency
+    unsigned long phase;        // 0 to FREQ_CYCLE
+    struct FreqPoint sums;
+    struct FreqPoint result;
+};
+
+extern const unsigned short freq_centihz[FREQ_POINTS];
+
+void start_freq_response(struct FreqResponse *);
+void stop_freq_response(struct FreqResponse *);
+signed char update_freq_response(struct FreqResponse *, unsigned long, 
+        signed char, short, char);
+
+#endif
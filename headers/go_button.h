@@ -12,14 +12,16 @@
 #include <shift_register.h>
 #include <ir_sensors.h>
 #include <motors.h>
+#include <coroutine.h>
 
 void init_go_button(void);
 void enable_go_button(void);
 void disable_go_button(void);
-void execute_delivery(void);
+char execute_delivery(struct Coroutine *);
+void resume_delivery(void);
 void enter_sleep_mode(void);
 void pause_delivery(void);
-char go_button_handler(char);
+char pause_sequence(struct Coroutine *);
 
 #endif	
 
@@ -0,0 +1,25 @@
+/* 
+ * File:   heading_hold.h
+ * Author: Jack
+ * Comments: Encoder based trim that keeps the wheels turning at the same
+ *           rate while the line is centered.
+ * Revision history: 
+ */
+
+#ifndef HEADING_HOLD_H
+#define	HEADING_HOLD_H
+
+struct HeadingHold
+{
+    char enabled;
+    int count_right_last;
+    int count_left_last;
+    int heading_error;          // accumulated count differential
+    signed char trim;
+};
+
+void init_heading_hold(struct HeadingHold *, char);
+void reset_heading_hold(struct HeadingHold *, int, int);
+signed char update_heading_hold(struct HeadingHold *, int, int);
+
+#endif
@@ -1,22 +1,53 @@
 #ifndef IR_SENSORS_H
 #define	IR_SENSORS_H
 
-#include <xc.h> 
+// ADC timing profiles, fastest first
+#define ADC_PROFILE_FAST 0
+#define ADC_PROFILE_BALANCED 1
+#define ADC_PROFILE_PRECISE 2
+#define ADC_PROFILES 3
+
+#define IR_SENSORS 3            // sensors in the ring, indexes 0 to 2
+#define CHARACTERIZE_SENSORS IR_SENSORS
 
 struct IRSensor
 {
     char adcon0_value;
     char index;
     char led;
-    char position;
+    signed char position;       // 1 left of center, 0 center, -1 right
     struct IRSensor *next_sensor;
+    char age;                   // samples of other sensors since this one
+    unsigned short samples;     // samples taken in the current rate window
+    unsigned short rate;        // samples per second over the last window
+    short reading;              // last processed reading
+    char stuck_count;           // consecutive identical readings
+    char noisy;                 // last change in reading was noise sized
+    char fault_count;           // decaying count of health violations
+    char violated;              // a check failed in the current health window
+    unsigned long health_ticks; // clock at the start of that window
+    char failed;                // 1 once excluded from the estimate
+    unsigned long sample_ticks; // clock when reading was processed
+    int sample_count_right;     // encoder counts at that moment
+    int sample_count_left;
+};
+
+struct ADCProfileStats
+{
+    unsigned short conversions_per_second;
+    unsigned short noise[CHARACTERIZE_SENSORS];     // std dev, 0.1 counts
 };
 
 void init_ADC(struct IRSensor *);
+void init_battery_ADC(void);
+void set_ADC_profile(char);
 void start_ADC(void);
 void stop_ADC(void);
 short read_and_update_ADC(struct IRSensor *);
 char convert_measurement_to_binary(short, short);
+struct IRSensor *scan_next_sensor(struct IRSensor *, char);
+void update_scan_rates(struct IRSensor *, unsigned long);
+char characterize_ADC(struct IRSensor *, struct ADCProfileStats *, short);
 
 #endif
 
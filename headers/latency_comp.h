@@ -0,0 +1,35 @@
+/* 
+ * File:   latency_comp.h
+ * Author: Jack
+ * Comments: Predicts the line offset forward over the delay between
+ *           sampling the IR sensors and the wheels answering a new duty,
+ *           from the wheel odometry since the sample and the steering
+ *           being applied, so the controller acts on where the line will
+ *           be rather than where it was. A Smith predictor with the
+ *           robot's own kinematics as the model.
+ * Revision history: 
+ */
+
+#ifndef LATENCY_COMP_H
+#define	LATENCY_COMP_H
+
+#define LATENCY_MOTOR_LAG_MS 50     // wheel speed time constant, as sim.h
+
+struct LatencyComp
+{
+    char enabled;
+    unsigned long sample_ticks;     // clock at the newest IR sample
+    int sample_count_right;         // encoder counts at that sample
+    int sample_count_left;
+    signed char steer;              // half duty difference being applied
+    unsigned short latency_ms;      // last measured, sample to wheels
+    short predicted;                // last predicted offset
+};
+
+void init_latency_comp(struct LatencyComp *, char);
+void mark_latency_sample(struct LatencyComp *, unsigned long, int, int);
+short predict_line_offset(struct LatencyComp *, short, unsigned long, int, 
+        int, unsigned short);
+char offset_pattern(short);
+
+#endif
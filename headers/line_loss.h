@@ -0,0 +1,36 @@
+/* 
+ * File:   line_loss.h
+ * Author: Jack
+ * Comments: Forecasts losing the line before the pattern goes to 000, from
+ *           how fast the analog line offset moves outward and how fast the
+ *           outermost sensor still on the line is fading, so the robot can
+ *           slow down and steer harder while it still sees the line.
+ * Revision history: 
+ */
+
+#ifndef LINE_LOSS_H
+#define	LINE_LOSS_H
+
+#include <ir_sensors.h>
+
+struct LossPredictor
+{
+    char enabled;
+    char imminent;              // 1 while a loss is forecast
+    unsigned short horizon_ms;  // forecasts within this are imminent
+    short cutoff;               // ADC reading that still counts as line
+    short offset_last;
+    short outer_last;
+    signed char side;           // 1 line left of center, -1 right
+    int offset_rate;            // offset counts per s, outward positive
+    int fade_rate;              // outer sensor counts per s, falling positive
+    unsigned short forecast_ms; // time to loss, 0xFFFF when none in sight
+};
+
+void init_loss_predictor(struct LossPredictor *, char, unsigned short, 
+        short);
+char update_loss_predictor(struct LossPredictor *, const struct IRSensor *, 
+        short, unsigned short);
+void avoid_line_loss(signed char *, signed char *);
+
+#endif
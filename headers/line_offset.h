@@ -0,0 +1,28 @@
+/* 
+ * File:   line_offset.h
+ * Author: Jack
+ * Comments: Analog estimate of where the line sits across the sensor
+ *           array, finer than the three bit pattern. The sensors share one
+ *           ADC and are read in turn, so at speed each one sees the floor
+ *           at a different moment; line_offset_at() moves every reading
+ *           to a common moment by the wheel odometry before combining.
+ * Revision history: 
+ */
+
+#ifndef LINE_OFFSET_H
+#define	LINE_OFFSET_H
+
+#include <ir_sensors.h>
+
+#define LINE_OFFSET_SCALE 128   // offset counts per sensor spacing
+
+// Robot geometry in mm, placeholders as sim.h
+#define WHEEL_BASE_MM 120
+#define SENSOR_AHEAD_MM 60      // sensor array ahead of the axle
+#define SENSOR_SPACING_MM 15    // between neighbouring sensors
+
+short line_offset(const struct IRSensor *);
+short line_offset_at(const struct IRSensor *, int, int);
+short array_shift(int, int);
+
+#endif
@@ -9,6 +9,7 @@
 #define	MOTORS_H
 
 #include <xc.h> 
+#include <coroutine.h>
 
 struct Motor 
 {
@@ -24,8 +25,8 @@ void motors_brake(void);
 void motors_drive(signed char, signed char);
 void motors_engage(void);
 void motors_disengage(void);
-void motors_turn_around(void);
-void motors_test(void);
+char motors_turn_around(struct Coroutine *);
+char motors_test(struct Coroutine *);
 
 #endif
 
@@ -0,0 +1,25 @@
+/* 
+ * File:   position_hold.h
+ * Author: Jack
+ * Comments: Servos both wheels to their encoder counts while paused.
+ * Revision history: 
+ */
+
+#ifndef POSITION_HOLD_H
+#define	POSITION_HOLD_H
+
+struct PositionHold
+{
+    char enabled;
+    char active;
+    int target_right;
+    int target_left;
+};
+
+void init_position_hold(struct PositionHold *, char);
+void engage_position_hold(struct PositionHold *, int, int);
+void release_position_hold(struct PositionHold *);
+void update_position_hold(struct PositionHold *, int, int, signed char *, 
+        signed char *);
+
+#endif
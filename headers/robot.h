@@ -0,0 +1,109 @@
+/* 
+ * File:   robot.h
+ * Author: Jack
+ * Comments: Firmware state of one robot, reached through ROBOT. On the PIC
+ *           ROBOT is the address of the one static instance, so every
+ *           access compiles to the same direct addressing a global would.
+ *           On the host it is a thread local pointer, so a simulator can
+ *           run many robots by pointing it at each one before stepping it.
+ * Revision history: 
+ */
+
+#ifndef ROBOT_H
+#define	ROBOT_H
+
+#include <ir_sensors.h>
+#include <encoders.h>
+#include <heading_hold.h>
+#include <position_hold.h>
+#include <docking.h>
+#include <speed_profile.h>
+#include <freq_response.h>
+#include <line_loss.h>
+#include <latency_comp.h>
+#include <coroutine.h>
+#include <telemetry_codec.h>
+
+struct Robot
+{
+    char go_flag;               // Current pushbutton status
+    char go_flag_0;             // Previous pushbutton status
+    char button_state;          // RB0 current state
+    char button_state_0;        // RB0 previous state
+    unsigned short count_lost;  // ms of updates with a lost reading
+    
+    char adc_flag;              // Flags the arrival of a new measurement
+    char adc_ready;             // Measurement processed, next conversion may start
+    char scan_flag;             // Flags a scan timestep, start a conversion
+    short adc_reading;          // Number of measurements from sensor
+    char adc_reading_number;    // Readings of the current sensor so far
+    char IR_meas_array;         // Combined binary values of the sensorarray
+    char IR_temp_array;         // Buffer for the sensor array
+    char IR_failed;             // Bit mask of sensors excluded by health checks
+    char scan_rate_flag;        // Flags the end of a scan rate window
+    char battery_flag;          // Flags that a battery sample is due
+    unsigned long scan_rate_ticks;  // start of the current rate window
+    
+    // IR sensor ring, and the battery divider sampled outside it
+    struct IRSensor IR_1;
+    struct IRSensor IR_2;
+    struct IRSensor IR_3;
+    struct IRSensor battery_sensor;
+    
+    // current sensor loaded in the ADC and the one for next cycle
+    struct IRSensor *sensor_read;
+    struct IRSensor *sensor_next;
+    
+    struct Encoder encoder_A;
+    struct Encoder encoder_B;
+    char encoder_mode;          // ENCODER_X4, ENCODER_X2 or ENCODER_X1
+    const signed char *encoder_steps;   // decode table for encoder_mode
+    
+    struct HeadingHold heading;
+    struct PositionHold position_hold;
+    struct Docking docking;
+    struct SpeedProfile profile;
+    struct FreqResponse freq;   // steering frequency response test
+    struct LossPredictor loss;
+    struct LatencyComp latency;
+    
+    // Light and motion sequence run by the scheduler, and one it calls
+    struct Coroutine sequence;
+    struct Coroutine sequence_call;
+    
+    char display_value;         // Byte to display on the status array
+    char display_flag;          // Flags a DISPLAY timestep for the main loop
+    char control_flag;          // Flags a CONTROL timestep for the main loop
+    char blink_count;           // Number of cycles for current blink status
+    
+    // Previous CONTROL timestep, for the wheel speed
+    int wheel_speed;            // Mean forward wheel speed, mm/s
+    int control_count_right;
+    int control_count_left;
+    unsigned long control_ticks;
+    char control_restart;       // CONTROL timestep restarted, the above is stale
+    
+    // Compressed telemetry, one record per CONTROL timestep while streaming
+    struct TelemetryEncoder telemetry;
+    char telemetry_on;
+    char telemetry_flag;
+    
+    unsigned long warm_ticks;   // last warm state save while running
+    
+    // TMR1 ticks between timesteps, read by the ISR
+    unsigned short scan_period;
+    unsigned short control_period;
+};
+
+#ifdef __XC8
+extern struct Robot robot;
+#define ROBOT (&robot)
+#else
+extern _Thread_local struct Robot *robot_context;
+#define ROBOT robot_context
+#endif
+
+void init_robot(struct Robot *);
+void copy_robot(struct Robot *, const struct Robot *);
+
+#endif
@@ -0,0 +1,21 @@
+/* 
+ * File:   sample_rates.h
+ * Author: Jack
+ * Comments: Scan and control timesteps scaled to the forward speed so the
+ *           robot samples the floor at a fixed spacing.
+ * Revision history: 
+ */
+
+#ifndef SAMPLE_RATES_H
+#define	SAMPLE_RATES_H
+
+// TMR1 ticks (2us)
+#define SCAN_PERIOD_MIN 100         // 200us, CPU budget for processing
+#define SCAN_PERIOD_MAX 1000        // 2ms, slowest refresh when standing still
+#define CONTROL_PERIOD_MIN 10000    // 20ms
+#define CONTROL_PERIOD_MAX 50000    // 100ms, the original fixed CONTROL
+
+unsigned short scan_period_for_speed(unsigned short);
+unsigned short control_period_for_speed(unsigned short);
+
+#endif
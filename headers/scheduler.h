@@ -0,0 +1,36 @@
+/* 
+ * File:   scheduler.h
+ * Author: Jack
+ * Comments: Cooperative task table run from the main loop, with a CPU load
+ *           governor that sheds non-critical tasks under overload.
+ * Revision history: 
+ */
+
+#ifndef SCHEDULER_H
+#define	SCHEDULER_H
+
+#include <xc.h>
+
+// Criticality classes, lower numbers are shed last
+#define TASK_CRITICAL 0         // sensing and control, never shed
+#define TASK_NORMAL 1           // telemetry, logging, commands
+#define TASK_BACKGROUND 2       // display and animations
+
+struct Task
+{
+    char (*run)(void);          // returns 1 if it did any work
+    char *flag;                 // event flag set by an ISR, 0 if polled
+    char criticality;
+    char decimation;            // run one in this many events, set by governor
+    char skipped;               // events dropped since the last run
+    char suspended;             // set by governor
+};
+
+extern char cpu_utilization;    // percent busy over the last window
+extern char shed_level;         // 0 nothing shed, up to SHED_LEVELS - 1
+extern char deadline_misses;    // CONTROL timesteps overrun, set by ISR
+
+void init_scheduler(struct Task *, char);
+void run_scheduler(void);
+
+#endif
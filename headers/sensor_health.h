@@ -0,0 +1,21 @@
+/* 
+ * File:   sensor_health.h
+ * Author: Jack
+ * Comments: Per-sample plausibility checks on the IR sensors, and the
+ *           pattern rebuilt around any that have failed. Plain C with no
+ *           registers, so it runs in the host simulator as well.
+ * Revision history: 
+ */
+
+#ifndef SENSOR_HEALTH_H
+#define	SENSOR_HEALTH_H
+
+#include <ir_sensors.h>
+
+void check_sensor_reading(struct IRSensor *, short);
+void check_pattern_health(struct IRSensor *, char, char, unsigned long);
+void reset_sensor_health(struct IRSensor *);
+char get_failed_sensors(struct IRSensor *);
+char mask_failed_sensors(char, char);
+
+#endif
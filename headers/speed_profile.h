@@ -0,0 +1,32 @@
+/* 
+ * File:   speed_profile.h
+ * Author: Jack
+ * Comments: Follows a speed planned offline along a known route by
+ *           scaling the pattern duty cycles with the travel since the
+ *           start. The table is generated by tools/plan_speed.c.
+ * Revision history: 
+ */
+
+#ifndef SPEED_PROFILE_H
+#define	SPEED_PROFILE_H
+
+#define PROFILE_STEP_MM 20      // route travel between table entries
+#define PROFILE_SPEED_UNIT 4    // mm/s per table count
+#define PROFILE_SPEED_MIN 60    // mm/s, lowest planned speed, to move off
+
+struct SpeedProfile
+{
+    char enabled;
+    int start_right;            // encoder counts at the start of the route
+    int start_left;
+};
+
+extern const unsigned char speed_table[];
+extern const unsigned short speed_table_length;
+
+void init_speed_profile(struct SpeedProfile *, char);
+void start_speed_profile(struct SpeedProfile *, int, int);
+unsigned short profile_speed(struct SpeedProfile *, int, int);
+signed char profile_duty(signed char, unsigned short);
+
+#endif
@@ -0,0 +1,67 @@
+/* 
+ * File:   telemetry_codec.h
+ * Author: Jack
+ * Comments: Compressed telemetry records shared by the firmware and the host
+ *           tools. Each channel is sent as the change since the last
+ *           record, zigzag mapped and Rice coded with a parameter that
+ *           follows the channel's recent changes, packed bit by bit.
+ *           Counters in TELEMETRY_PREDICTED send the change from their
+ *           last step instead, which is mostly 0. Every delta record ends
+ *           in a check byte over the values it decodes to, so a lost byte
+ *           drops the decoder back to hunting rather than leaving it
+ *           decoding wrong values. Every TELEMETRY_KEYFRAME records a
+ *           keyframe carries the absolute values and a CRC so a decoder
+ *           can join mid-stream and recover from lost bytes.
+ * Revision history: 
+ */
+
+#ifndef TELEMETRY_CODEC_H
+#define	TELEMETRY_CODEC_H
+
+#define TELEMETRY_CHANNELS 8    // at most 8, one mask bit each
+#define TELEMETRY_KEYFRAME 32   // records per keyframe, including it
+#define TELEMETRY_SYNC_0 0xA5   // keyframe start
+#define TELEMETRY_SYNC_1 0x5A
+#define TELEMETRY_RECORD_MAX (1 + 4 * TELEMETRY_CHANNELS)  // escaped deltas
+#define TELEMETRY_PREDICTED 0x31    // channels sent as change of step: time,
+                                    // encoder counts
+
+// Recent size of each channel's codes, picks its Rice parameter
+struct TelemetryRice
+{
+    unsigned short sum[TELEMETRY_CHANNELS];
+    unsigned char count[TELEMETRY_CHANNELS];
+};
+
+struct TelemetryEncoder
+{
+    short last[TELEMETRY_CHANNELS];
+    short step[TELEMETRY_CHANNELS];     // last change, for the predicted
+    struct TelemetryRice rice;
+    unsigned char count;        // records since the last keyframe
+};
+
+struct TelemetryDecoder
+{
+    short values[TELEMETRY_CHANNELS];   // last complete record
+    short pending[TELEMETRY_CHANNELS];  // keyframe being received
+    short step[TELEMETRY_CHANNELS];     // last change, for the predicted
+    struct TelemetryRice rice;
+    unsigned char count;
+    unsigned char state;
+    unsigned char channel;
+    unsigned short value;       // varint or Rice code being received
+    unsigned char shift;        // varint bits so far
+    unsigned char phase;        // part of the Rice code being received
+    unsigned char bits;         // ones so far, or code bits still to come
+    unsigned char k;            // Rice parameter of the channel
+    unsigned long errors;       // keyframes missed, failed CRCs and checks
+};
+
+void reset_telemetry_encoder(struct TelemetryEncoder *);
+unsigned char encode_telemetry(struct TelemetryEncoder *, const short *, 
+        unsigned char *);
+void reset_telemetry_decoder(struct TelemetryDecoder *);
+char decode_telemetry_byte(struct TelemetryDecoder *, unsigned char);
+
+#endif
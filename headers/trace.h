@@ -0,0 +1,82 @@
+/* 
+ * File:   trace.h
+ * Author: Jack
+ * Comments: Event trace in a RAM ring buffer, dumped with 'T' over the UART
+ *           and converted by tools/trace2json.c. Build with TRACE_ENABLE 1
+ *           to include it; with 0 every TRACE macro compiles to nothing.
+ * Revision history: 
+ */
+
+#ifndef TRACE_H
+#define	TRACE_H
+
+#ifndef TRACE_ENABLE
+#define TRACE_ENABLE 0
+#endif
+
+#if TRACE_ENABLE
+#include <xc.h>
+#endif
+
+// Record types
+#define TRACE_ISR_ENTER 1       // id 0 low priority, 1 high priority
+#define TRACE_ISR_EXIT 2
+#define TRACE_TASK_START 3      // id is the index in the task table
+#define TRACE_TASK_STOP 4
+#define TRACE_STATE 5           // id is TRACE_STATE_x | value
+#define TRACE_MARK 6            // id is free for the user
+
+// State domains for TRACE_STATE, value in the low nibble
+#define TRACE_STATE_GO 0x10
+#define TRACE_STATE_DOCK 0x20
+#define TRACE_STATE_SHED 0x30
+#define TRACE_STATE_ENCODER 0x40
+#define TRACE_STATE_LOSS 0x50
+
+#define TRACE_RECORDS 128       // power of two, 4 bytes each
+
+struct TraceRecord
+{
+    unsigned char type;
+    unsigned char id;
+    unsigned char time_low;     // TMR1 at the event, 2us per tick
+    unsigned char time_high;
+};
+
+#if TRACE_ENABLE
+
+extern struct TraceRecord trace_buffer[TRACE_RECORDS];
+extern unsigned char trace_head;
+extern char trace_paused;
+
+/*
+Writes one record inline so it can be used in the ISRs without a call. TMR1
+is read low byte first; the rare low byte rollover in between shows up as
+one record 512us late. Tasks and both ISRs trace, so the record is claimed
+and written with the interrupts held off. GIEH is put back as found, as it
+is already clear in the high priority ISR.
+*/
+#define TRACE(record_type, record_id) do { \
+    if (!trace_paused) { \
+        char trace_gie = INTCONbits.GIEH; \
+        INTCONbits.GIEH = 0; \
+        struct TraceRecord *trace_record = &trace_buffer[trace_head]; \
+        trace_record->type = (record_type); \
+        trace_record->id = (record_id); \
+        trace_record->time_low = TMR1L; \
+        trace_record->time_high = TMR1H; \
+        trace_head = (trace_head + 1) & (TRACE_RECORDS - 1); \
+        INTCONbits.GIEH = trace_gie; \
+    } \
+} while (0)
+
+void dump_trace(void);
+
+#else
+
+#define TRACE(record_type, record_id)
+#define dump_trace()
+
+#endif
+
+#endif
@@ -0,0 +1,17 @@
+/* 
+ * File:   uart.h
+ * Author: Jack
+ * Comments: EUSART1 link used for reports and downloads, 115200 8N1.
+ * Revision history: 
+ */
+
+#ifndef UART_H
+#define	UART_H
+
+#include <xc.h>
+
+void init_UART(void);
+void putch(char);
+char uart_read(char *);
+
+#endif
@@ -0,0 +1,31 @@
+/* 
+ * File:   warm_restart.h
+ * Author: Jack
+ * Comments: Delivery state kept in uninitialized RAM so a watchdog reset
+ *           can pick the delivery back up. The CRC covers the delivery
+ *           statistics in delivery_log.c as well, so a change to them is
+ *           only trusted once saved. clock_overflows moves too often to be
+ *           covered, and is cleared with the rest when the CRC fails.
+ * Revision history: 
+ */
+
+#ifndef WARM_RESTART_H
+#define	WARM_RESTART_H
+
+#include <xc.h>
+
+struct WarmState
+{
+    char go_flag;
+    int count_right;
+    int count_left;
+    char crc;                   // CRC-8 of the fields above, then the stats
+};
+
+extern struct WarmState warm_state;
+
+void save_warm_state(char, int, int);
+char check_warm_restart(void);
+void clear_reset_flags(void);
+
+#endif
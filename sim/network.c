@@ -0,0 +1,571 @@
+/*
+ * File:   network.c
+ * Author: Jack
+ *
+ * Created on December 27, 2020, 10:00 AM
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <clock.h>
+#include <control.h>
+#include <network.h>
+#include <sim.h>
+
+#define FOLLOW_MM 250.0f        // placeholder, nose to nose gap kept
+#define FOLLOW_DECEL 500.0f     // mm/s^2, braking planned for, as DOCK_DECEL
+#define BLOCKED_SPEED 25.0f     // mm/s, held below this counts as blocked
+#define MARKER_MM 30.0f         // placeholder, stop marker length
+#define MARKER_TO_STOP 60.0f    // DOCK_DISTANCE in docking.c
+#define FLOOR_READING 600       // ADC counts, as the simulators' IR model
+#define LINE_READING 3900
+#define NO_ROUTE 1e30f
+
+static int add_node(struct SimNetwork *, const char *, char);
+static int add_edge(struct SimNetwork *, int, int, float);
+static int find_node(const struct SimNetwork *, const char *);
+static int next_edge(const struct SimNetwork *, const struct SimTrafficRobot *);
+static float leader_gap(const struct SimTraffic *, int);
+static float plan_robot(struct SimTraffic *, int, float);
+static void dispatch(struct SimTraffic *);
+static void add_job(struct SimTraffic *);
+static float random_unit(struct SimTraffic *);
+
+int sim_load_network(struct SimNetwork *network, const char *path){
+    /*
+    Reads a network, one line each:
+        station NAME
+        junction NAME
+        edge FROM TO LENGTH_MM
+    Lines starting with # are comments. A station's stop marker sits at the
+    end of every edge into it. The first edge out of a node is the way an
+    idle robot carries on. Returns 0 on a bad file.
+    */
+    FILE *file = fopen(path, "r");
+    char text[128];
+    char from[16];
+    char to[16];
+    float length;
+    
+    if (file == 0){
+        return 0;
+    }
+    
+    memset(network, 0, sizeof(*network));
+    
+    while (fgets(text, sizeof(text), file)){
+        int ok = 1;
+        
+        if (text[0] == '#' || text[0] == '\n'){
+            continue;
+        }
+        
+        if (sscanf(text, "station %15s", from) == 1){
+            ok = add_node(network, from, 1) >= 0;
+        }
+        
+        else if (sscanf(text, "junction %15s", from) == 1){
+            ok = add_node(network, from, 0) >= 0;
+        }
+        
+        else if (sscanf(text, "edge %15s %15s %f", from, to, &length) == 3){
+            ok = length > 0 && add_edge(network, find_node(network, from),
+                    find_node(network, to), length);
+        }
+        
+        else {
+            ok = 0;
+        }
+        
+        if (!ok){
+            fprintf(stderr, "bad network line: %s", text);
+            fclose(file);
+            return 0;
+        }
+    }
+    
+    fclose(file);
+    return 1;
+}
+
+void sim_loop_network(struct SimNetwork *network, int stations,
+        float spacing){
+    /*
+    A one way loop of junctions spacing mm apart with a station on a siding
+    off each stretch, so docked robots and their queues stay clear of the
+    loop. The siding is longer than the stretch it bypasses, so routes only
+    take it to stop there.
+    */
+    char name[16];
+    
+    memset(network, 0, sizeof(*network));
+    
+    if (stations > SIM_NODES / 2){
+        stations = SIM_NODES / 2;
+    }
+    
+    for (int i = 0; i < stations; ++i){
+        snprintf(name, sizeof(name), "J%d", i);
+        add_node(network, name, 0);
+        snprintf(name, sizeof(name), "S%d", i);
+        add_node(network, name, 1);
+    }
+    
+    for (int i = 0; i < stations; ++i){
+        int junction = 2 * i;
+        int next = 2 * ((i + 1) % stations);
+        
+        add_edge(network, junction, next, spacing);
+        add_edge(network, junction, junction + 1, spacing * 0.6f);
+        add_edge(network, junction + 1, next, spacing * 0.6f);
+    }
+}
+
+int sim_route_network(struct SimNetwork *network){
+    /*
+    Shortest routes between every pair of nodes, Floyd-Warshall keeping the
+    first edge of each route. Returns 0 when a node is a dead end or some
+    station cannot be reached from everywhere.
+    */
+    int n = network->nodes;
+    
+    for (int i = 0; i < n; ++i){
+        for (int j = 0; j < n; ++j){
+            network->distance[i][j] = i == j ? 0 : NO_ROUTE;
+            network->route[i][j] = -1;
+        }
+    }
+    
+    for (int e = 0; e < network->edges; ++e){
+        const struct SimEdge *edge = &network->edge[e];
+        
+        if (edge->length < network->distance[edge->from][edge->to]){
+            network->distance[edge->from][edge->to] = edge->length;
+            network->route[edge->from][edge->to] = (signed char)e;
+        }
+    }
+    
+    for (int k = 0; k < n; ++k){
+        for (int i = 0; i < n; ++i){
+            for (int j = 0; j < n; ++j){
+                float via = network->distance[i][k] + network->distance[k][j];
+                
+                if (via < network->distance[i][j]){
+                    network->distance[i][j] = via;
+                    network->route[i][j] = network->route[i][k];
+                }
+            }
+        }
+    }
+    
+    for (int i = 0; i < n; ++i){
+        if (network->node[i].outs == 0){
+            return 0;
+        }
+        
+        for (int j = 0; j < n; ++j){
+            if (network->node[j].station &&
+                    network->distance[i][j] >= NO_ROUTE){
+                return 0;
+            }
+        }
+    }
+    
+    return 1;
+}
+
+void sim_start_traffic(struct SimTraffic *traffic,
+        const struct SimNetwork *network, int robots, char policy,
+        float jobs_per_h, float service_s, unsigned seed){
+    /*
+    Spreads the robots evenly, idle, round the circuit an idle robot follows
+    from node 0, each with its firmware context at power on.
+    */
+    int circuit[SIM_EDGES];
+    int edges = 0;
+    float length = 0;
+    int node = 0;
+    
+    memset(traffic, 0, sizeof(*traffic));
+    traffic->network = network;
+    traffic->robots = robots < SIM_ROBOTS ? robots : SIM_ROBOTS;
+    traffic->policy = policy;
+    traffic->jobs_per_s = jobs_per_h / 3600;
+    traffic->service_s = service_s;
+    traffic->rng = seed ? seed : 1;
+    
+    do {
+        circuit[edges] = network->node[node].out[0];
+        length += network->edge[circuit[edges]].length;
+        node = network->edge[circuit[edges]].to;
+        ++edges;
+    } while (node != 0 && edges < SIM_EDGES);
+    
+    for (int i = 0; i < traffic->robots; ++i){
+        struct SimTrafficRobot *r = &traffic->robot[i];
+        float along = length * i / traffic->robots;
+        int e = 0;
+        
+        while (e < edges - 1 && along >= network->edge[circuit[e]].length){
+            along -= network->edge[circuit[e]].length;
+            ++e;
+        }
+        
+        r->edge = circuit[e];
+        r->position = along;
+        r->target = -1;
+        
+        robot_context = &r->firmware;
+        init_robot(ROBOT);
+        init_control();
+        start_control(0, 0, 0);
+        ROBOT->control_restart = 1;
+    }
+    
+    if (traffic->jobs_per_s > 0){
+        traffic->next_job = -logf(random_unit(traffic)) / traffic->jobs_per_s;
+    }
+}
+
+void sim_step_traffic(struct SimTraffic *traffic, float dt){
+    /*
+    One step of dt seconds. Jobs arrive as a Poisson stream and are handed
+    out, then every robot plans its duty from where everyone was, and only
+    then do they all move.
+    */
+    const struct SimNetwork *network = traffic->network;
+    const float alpha = dt / (SIM_MOTOR_TAU + dt);
+    float duty[SIM_ROBOTS];
+    
+    traffic->time += dt;
+    
+    while (traffic->jobs_per_s > 0 && traffic->next_job <= traffic->time){
+        add_job(traffic);
+        traffic->next_job -= logf(random_unit(traffic)) / traffic->jobs_per_s;
+    }
+    
+    dispatch(traffic);
+    
+    for (int i = 0; i < traffic->robots; ++i){
+        duty[i] = plan_robot(traffic, i, dt);
+    }
+    
+    for (int i = 0; i < traffic->robots; ++i){
+        struct SimTrafficRobot *r = &traffic->robot[i];
+        
+        r->speed += alpha * (duty[i] * SIM_MM_S_PER_DUTY - r->speed);
+        r->position += r->speed * dt;
+        r->travel += r->speed * dt;
+        
+        // Stays on the edge while stopping at its end
+        while (!(r->target == network->edge[r->edge].to &&
+                (r->docked || r->firmware.docking.state != DOCK_IDLE)) &&
+                r->position >= network->edge[r->edge].length){
+            r->position -= network->edge[r->edge].length;
+            r->edge = next_edge(network, r);
+        }
+    }
+}
+
+void sim_clear_traffic_stats(struct SimTraffic *traffic){
+    traffic->stats_start = traffic->time;
+    traffic->deliveries = 0;
+    traffic->pickups = 0;
+    traffic->turned_away = 0;
+    traffic->wait_s = 0;
+    traffic->busy_s = 0;
+    traffic->blocked_s = 0;
+}
+
+static float plan_robot(struct SimTraffic *traffic, int i, float dt){
+    /*
+    Duty for one robot, from its own firmware. The robot is taken as
+    centered on the line, so its sensors read 010, and 111 over the stop
+    marker of the station it is heading for. Other stations' markers are
+    not shown, a robot only passes through a station on the way to it.
+    Every sensor is read each step, and control_step() runs once its
+    period has passed, on encoder counts from the robot's travel. The
+    robot has docked when the firmware brakes.
+    
+    The firmware cannot see other robots, so the duty is then capped for
+    the fleet's traffic rule: it can still stop FOLLOW_MM short of whatever
+    is ahead, by the same v = sqrt(2 a d) law docking uses.
+    */
+    struct SimTrafficRobot *r = &traffic->robot[i];
+    const struct SimEdge *edge = &traffic->network->edge[r->edge];
+    int counts = (int)(r->travel * COUNTS_PER_REV / WHEEL_TRAVEL_MM);
+    unsigned long ticks = (unsigned long)(traffic->time * TMR1_HZ);
+    
+    robot_context = &r->firmware;
+    
+    if (r->stage != SIM_STAGE_IDLE){
+        traffic->busy_s += dt;
+    }
+    
+    if (r->docked){
+        r->service_left -= dt;
+        
+        if (r->service_left > 0){
+            return 0;
+        }
+        
+        if (r->stage == SIM_STAGE_PICKUP){
+            r->stage = SIM_STAGE_DROP;
+            r->target = r->job.drop;
+        }
+        
+        else {
+            ++traffic->deliveries;
+            r->stage = SIM_STAGE_IDLE;
+            r->target = -1;
+            r->idle_since = traffic->time;
+        }
+        
+        // the next leg starts as a new delivery, as the button would
+        r->docked = 0;
+        start_control(0, counts, counts);
+        ROBOT->control_restart = 1;
+    }
+    
+    float marker = edge->length - MARKER_TO_STOP;
+    char on_marker = r->target == edge->to && r->position >= marker &&
+                     r->position < marker + MARKER_MM;
+    struct IRSensor *sensor = &ROBOT->IR_1;
+    
+    for (int s = 0; s < IR_SENSORS; ++s){
+        char line = on_marker || sensor->position == 0;
+        
+        control_sample(sensor, line ? LINE_READING : FLOOR_READING, ticks, 
+                counts, counts);
+        sensor = sensor->next_sensor;
+    }
+    
+    if (ROBOT->control_restart || 
+            ticks - ROBOT->control_ticks >= ROBOT->control_period){
+        signed char right;
+        signed char left;
+        char status = control_step(ticks, counts, counts, &right, &left);
+        
+        ROBOT->control_period = control_period(ROBOT->wheel_speed);
+        
+        if (status == CONTROL_BRAKE){
+            r->docked = 1;
+            r->duty = 0;
+            r->service_left = traffic->service_s;
+            
+            if (r->stage == SIM_STAGE_PICKUP){
+                ++traffic->pickups;
+                traffic->wait_s += traffic->time - r->job.created;
+            }
+            
+            return 0;
+        }
+        
+        if (status != CONTROL_LOST){
+            r->duty = (right + left) / 2.0f;
+        }
+    }
+    
+    float duty = r->duty;
+    float gap = leader_gap(traffic, i) - FOLLOW_MM;
+    float allowed = gap > 0 ? sqrtf(2 * FOLLOW_DECEL * gap) : 0;
+    float cap = allowed * CRUISE_DUTY / CRUISE_SPEED;
+    
+    if (duty > cap){
+        duty = cap;
+        
+        if (allowed < BLOCKED_SPEED){
+            traffic->blocked_s += dt;
+        }
+    }
+    
+    return duty;
+}
+
+static float leader_gap(const struct SimTraffic *traffic, int i){
+    /*
+    Distance to the nearest robot ahead: on the same edge, on the edge this
+    robot goes on to, or on another edge into the same node and nearer to
+    it, which has the right of way at the merge. Edges shorter than the
+    stopping distance can hide a robot two edges on.
+    */
+    const struct SimNetwork *network = traffic->network;
+    const struct SimTrafficRobot *r = &traffic->robot[i];
+    const struct SimEdge *edge = &network->edge[r->edge];
+    float ahead = edge->length - r->position;
+    int next = r->target == edge->to ? -1 : next_edge(network, r);
+    float gap = NO_ROUTE;
+    
+    for (int j = 0; j < traffic->robots; ++j){
+        const struct SimTrafficRobot *q = &traffic->robot[j];
+        const struct SimEdge *other = &network->edge[q->edge];
+        float d = NO_ROUTE;
+        
+        if (j == i){
+            continue;
+        }
+        
+        if (q->edge == r->edge){
+            if (q->position > r->position ||
+                    (q->position == r->position && j < i)){
+                d = q->position - r->position;
+            }
+        }
+        
+        else if (q->edge == next){
+            d = ahead + q->position;
+        }
+        
+        else if (other->to == edge->to){
+            float q_ahead = other->length - q->position;
+            
+            if (q_ahead < ahead || (q_ahead == ahead && j < i)){
+                d = ahead - q_ahead;
+            }
+        }
+        
+        if (d < gap){
+            gap = d;
+        }
+    }
+    
+    return gap;
+}
+
+static void dispatch(struct SimTraffic *traffic){
+    // Hands out pending jobs oldest first while there are idle robots
+    const struct SimNetwork *network = traffic->network;
+    
+    while (traffic->pending_count > 0){
+        struct SimJob *job = &traffic->pending[traffic->pending_first];
+        int best = -1;
+        double best_score = 0;
+        
+        for (int i = 0; i < traffic->robots; ++i){
+            const struct SimTrafficRobot *r = &traffic->robot[i];
+            const struct SimEdge *edge = &network->edge[r->edge];
+            double score;
+            
+            if (r->stage != SIM_STAGE_IDLE){
+                continue;
+            }
+            
+            if (traffic->policy == SIM_POLICY_NEAREST){
+                score = edge->length - r->position +
+                        network->distance[edge->to][job->pickup];
+            }
+            else {
+                score = r->idle_since;
+            }
+            
+            if (best < 0 || score < best_score){
+                best = i;
+                best_score = score;
+            }
+        }
+        
+        if (best < 0){
+            return;
+        }
+        
+        traffic->robot[best].stage = SIM_STAGE_PICKUP;
+        traffic->robot[best].target = job->pickup;
+        traffic->robot[best].job = *job;
+        traffic->pending_first = (traffic->pending_first + 1) % SIM_JOBS;
+        --traffic->pending_count;
+    }
+}
+
+static void add_job(struct SimTraffic *traffic){
+    // A delivery between two different stations picked at random
+    const struct SimNetwork *network = traffic->network;
+    int stations[SIM_NODES];
+    int count = 0;
+    
+    for (int i = 0; i < network->nodes; ++i){
+        if (network->node[i].station){
+            stations[count++] = i;
+        }
+    }
+    
+    if (count < 2 || traffic->pending_count == SIM_JOBS){
+        ++traffic->turned_away;
+        return;
+    }
+    
+    int pickup = (int)(random_unit(traffic) * count);
+    int drop = (pickup + 1 + (int)(random_unit(traffic) * (count - 1))) %
+               count;
+    struct SimJob *job = &traffic->pending[(traffic->pending_first +
+            traffic->pending_count) % SIM_JOBS];
+    
+    job->pickup = stations[pickup];
+    job->drop = stations[drop];
+    job->created = traffic->time;
+    ++traffic->pending_count;
+}
+
+static int next_edge(const struct SimNetwork *network,
+        const struct SimTrafficRobot *r){
+    // Along the route to the target, or straight on when there is none
+    int node = network->edge[r->edge].to;
+    
+    if (r->target >= 0 && network->route[node][r->target] >= 0){
+        return network->route[node][r->target];
+    }
+    
+    return network->node[node].out[0];
+}
+
+static int add_node(struct SimNetwork *network, const char *name,
+        char station){
+    if (network->nodes == SIM_NODES || find_node(network, name) >= 0){
+        return -1;
+    }
+    
+    struct SimNode *node = &network->node[network->nodes];
+    
+    snprintf(node->name, sizeof(node->name), "%s", name);
+    node->station = station;
+    return network->nodes++;
+}
+
+static int add_edge(struct SimNetwork *network, int from, int to,
+        float length){
+    // Returns 0 when full, or when from already has two ways out
+    if (from < 0 || to < 0 || network->edges == SIM_EDGES ||
+            network->node[from].outs == 2){
+        return 0;
+    }
+    
+    struct SimNode *node = &network->node[from];
+    
+    network->edge[network->edges].from = from;
+    network->edge[network->edges].to = to;
+    network->edge[network->edges].length = length;
+    node->out[(int)node->outs++] = network->edges++;
+    return 1;
+}
+
+static int find_node(const struct SimNetwork *network, const char *name){
+    for (int i = 0; i < network->nodes; ++i){
+        if (strcmp(network->node[i].name, name) == 0){
+            return i;
+        }
+    }
+    
+    return -1;
+}
+
+static float random_unit(struct SimTraffic *traffic){
+    // Uniform in (0, 1), never 0 so it can go through a log
+    unsigned r = traffic->rng;
+    
+    r ^= r << 13;
+    r ^= r >> 17;
+    r ^= r << 5;
+    traffic->rng = r;
+    
+    return ((r >> 9) + 0.5f) * (1.0f / 8388608);
+}
@@ -0,0 +1,117 @@
+/*
+ * File:   network.h
+ * Author: Jack
+ * Comments: Fleet traffic on a shared line network. The network is a
+ *           directed graph of junctions and stations joined by lines of
+ *           known length, and robots move along it one dimensionally. Each
+ *           robot runs the firmware's control law (control.c) on its own
+ *           context, from sensor readings of a centered line and the stop
+ *           markers, and docks through it. Robots keep a
+ *           following distance, yield at merges and queue behind whoever
+ *           is docked, so blocking comes out of the motion rather than
+ *           being assumed.
+ * Revision history:
+ */
+
+#ifndef NETWORK_H
+#define	NETWORK_H
+
+#include <robot.h>
+
+#define SIM_NODES 32
+#define SIM_EDGES 64
+#define SIM_ROBOTS 64
+#define SIM_JOBS 256            // pending jobs, more are turned away
+
+#define SIM_POLICY_FIFO 0       // oldest job to the robot idle longest
+#define SIM_POLICY_NEAREST 1    // oldest job to the idle robot nearest it
+
+#define SIM_STAGE_IDLE 0        // circulating, free for a job
+#define SIM_STAGE_PICKUP 1      // on the way to the pickup station
+#define SIM_STAGE_DROP 2        // loaded, on the way to the drop station
+
+struct SimNode
+{
+    char name[16];
+    char station;               // robots can dock here
+    char outs;
+    int out[2];                 // edges leaving, out[0] is the way on when idle
+};
+
+struct SimEdge
+{
+    int from;
+    int to;
+    float length;               // mm
+};
+
+struct SimNetwork
+{
+    int nodes;
+    int edges;
+    struct SimNode node[SIM_NODES];
+    struct SimEdge edge[SIM_EDGES];
+    
+    // Shortest routes, filled by sim_route_network()
+    float distance[SIM_NODES][SIM_NODES];   // mm from node to node
+    signed char route[SIM_NODES][SIM_NODES];    // first edge, -1 unreachable
+};
+
+struct SimJob
+{
+    int pickup;
+    int drop;
+    double created;             // s
+};
+
+struct SimTrafficRobot
+{
+    struct Robot firmware;
+    int edge;
+    float position;             // mm along the edge
+    float speed;                // mm/s
+    float travel;               // mm, both wheels, for the encoder counts
+    float duty;                 // mean of the firmware's wheel duties
+    char stage;
+    char docked;
+    int target;                 // node heading for, -1 when idle
+    struct SimJob job;
+    float service_left;         // s still to spend at the station
+    double idle_since;          // s
+};
+
+struct SimTraffic
+{
+    const struct SimNetwork *network;
+    int robots;
+    char policy;
+    float jobs_per_s;
+    float service_s;            // s docked at each pickup and drop
+    double time;                // s
+    double next_job;            // s
+    unsigned rng;
+    
+    struct SimTrafficRobot robot[SIM_ROBOTS];
+    struct SimJob pending[SIM_JOBS];
+    int pending_first;
+    int pending_count;
+    
+    // Totals since the last sim_clear_traffic_stats()
+    double stats_start;         // s
+    unsigned long deliveries;
+    unsigned long pickups;
+    unsigned long turned_away;
+    double wait_s;              // job created to robot docked at the pickup
+    double busy_s;              // robot time spent on jobs
+    double blocked_s;           // robot time held up by another robot
+};
+
+int sim_load_network(struct SimNetwork *, const char *);
+void sim_loop_network(struct SimNetwork *, int, float);
+int sim_route_network(struct SimNetwork *);
+void sim_start_traffic(struct SimTraffic *, const struct SimNetwork *, int,
+        char, float, float, unsigned);
+void sim_step_traffic(struct SimTraffic *, float);
+void sim_clear_traffic_stats(struct SimTraffic *);
+
+#endif
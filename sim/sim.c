@@ -0,0 +1,489 @@
+/*
+ * File:   sim.c
+ * Author: Jack
+ *
+ * Created on December 23, 2020, 10:00 AM
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <encoders.h>
+#include <robot.h>
+#include <control.h>
+#include <sim.h>
+
+#define SIM_ALIGN 64            // bytes, a cache line and any vector width
+#define SIM_BLUR_SIGMAS 3       // blur kernel reaches this many sigma
+
+static float *alloc_floats(int);
+static int *alloc_ints(int);
+static void blur_line(float *, const float *, int, const float *, int);
+static void integrate_lanes(int, float, const float *, const float *, float *,
+        float *, float *, float *, float *, float *, int *, int *);
+static void sample_lanes(int, float, const struct SimTrack *,
+        const struct SimIRModel *, const float *, const float *,
+        const float *, const float *, const float *, const float *,
+        float *, unsigned *, float *);
+
+int sim_alloc_fleet(struct SimFleet *fleet, int count){
+    /*
+    Allocates every array for count robots, all zero. Returns 0 when out of
+    memory. The padding robots past count stand still and are never read.
+    */
+    int capacity = (count + SIM_LANES - 1) / SIM_LANES * SIM_LANES;
+    
+    memset(fleet, 0, sizeof(*fleet));
+    fleet->count = count;
+    fleet->capacity = capacity;
+    fleet->x = alloc_floats(capacity);
+    fleet->y = alloc_floats(capacity);
+    fleet->cos_heading = alloc_floats(capacity);
+    fleet->sin_heading = alloc_floats(capacity);
+    fleet->duty_right = alloc_floats(capacity);
+    fleet->duty_left = alloc_floats(capacity);
+    fleet->speed_right = alloc_floats(capacity);
+    fleet->speed_left = alloc_floats(capacity);
+    fleet->travel_right = alloc_floats(capacity);
+    fleet->travel_left = alloc_floats(capacity);
+    fleet->count_right = alloc_ints(capacity);
+    fleet->count_left = alloc_ints(capacity);
+    fleet->rng = (unsigned *)alloc_ints(capacity);
+    
+    int ok = fleet->x && fleet->y && fleet->cos_heading &&
+            fleet->sin_heading && fleet->duty_right && fleet->duty_left &&
+            fleet->speed_right && fleet->speed_left && fleet->travel_right &&
+            fleet->travel_left && fleet->count_right && fleet->count_left &&
+            fleet->rng;
+    
+    for (int s = 0; s < SIM_SENSORS; ++s){
+        fleet->adc[s] = alloc_floats(capacity);
+        fleet->noise[s] = alloc_floats(capacity);
+        ok = ok && fleet->adc[s] && fleet->noise[s];
+    }
+    
+    if (!ok){
+        sim_free_fleet(fleet);
+        return 0;
+    }
+    
+    for (int i = 0; i < capacity; ++i){
+        fleet->cos_heading[i] = 1.0f;
+        fleet->rng[i] = 2654435761u * (i + 1);     // any nonzero seed
+    }
+    
+    return 1;
+}
+
+void sim_free_fleet(struct SimFleet *fleet){
+    free(fleet->x);
+    free(fleet->y);
+    free(fleet->cos_heading);
+    free(fleet->sin_heading);
+    free(fleet->duty_right);
+    free(fleet->duty_left);
+    free(fleet->speed_right);
+    free(fleet->speed_left);
+    free(fleet->travel_right);
+    free(fleet->travel_left);
+    free(fleet->count_right);
+    free(fleet->count_left);
+    free(fleet->rng);
+    
+    for (int s = 0; s < SIM_SENSORS; ++s){
+        free(fleet->adc[s]);
+        free(fleet->noise[s]);
+    }
+    
+    memset(fleet, 0, sizeof(*fleet));
+}
+
+void sim_place(struct SimFleet *fleet, int robot, float x, float y,
+        float heading){
+    // Puts one robot at rest at x, y in mm facing heading in radians
+    fleet->x[robot] = x;
+    fleet->y[robot] = y;
+    fleet->cos_heading[robot] = cosf(heading);
+    fleet->sin_heading[robot] = sinf(heading);
+    fleet->speed_right[robot] = 0.0f;
+    fleet->speed_left[robot] = 0.0f;
+}
+
+int sim_alloc_track(struct SimTrack *track, int width, int height,
+        float mm_per_pixel){
+    // Blank track, returns 0 when out of memory
+    track->width = width;
+    track->height = height;
+    track->mm_per_pixel = mm_per_pixel;
+    track->darkness = calloc((size_t)width * height, sizeof(float));
+    
+    return track->darkness != 0;
+}
+
+void sim_free_track(struct SimTrack *track){
+    free(track->darkness);
+    track->darkness = 0;
+}
+
+void sim_draw_oval(struct SimTrack *track, float radius_x, float radius_y,
+        float line_mm){
+    /*
+    Draws an elliptical line loop centered on the image, line_mm wide,
+    with a one pixel soft edge. The distance to the ellipse is approximated
+    by scaling the radial miss by the local radius.
+    */
+    float center_x = track->width * track->mm_per_pixel / 2;
+    float center_y = track->height * track->mm_per_pixel / 2;
+    
+    for (int row = 0; row < track->height; ++row){
+        for (int col = 0; col < track->width; ++col){
+            float dx = (col + 0.5f) * track->mm_per_pixel - center_x;
+            float dy = (row + 0.5f) * track->mm_per_pixel - center_y;
+            float r = sqrtf(dx * dx / (radius_x * radius_x) +
+                            dy * dy / (radius_y * radius_y));
+            float local = sqrtf(dx * dx + dy * dy) / (r > 0 ? r : 1);
+            float miss = fabsf(r - 1) * local - line_mm / 2;
+            float edge = 1 - miss / track->mm_per_pixel;
+            
+            edge = edge < 0 ? 0 : edge > 1 ? 1 : edge;
+            track->darkness[row * track->width + col] = edge;
+        }
+    }
+}
+
+void sim_start_control(struct SimFleet *fleet, struct Robot *robots){
+    /*
+    Powers up the firmware of every robot in the fleet, one context each,
+    and starts a delivery from where it stands, as the button would.
+    */
+    for (int i = 0; i < fleet->count; ++i){
+        init_robot(&robots[i]);
+        robot_context = &robots[i];
+        init_control();
+        start_control(0, fleet->count_right[i], fleet->count_left[i]);
+        ROBOT->control_restart = 1;
+    }
+}
+
+void sim_control(struct SimFleet *fleet, struct Robot *robots,
+        unsigned long ticks){
+    // The firmware of every robot in the fleet, see sim_control_robot()
+    for (int i = 0; i < fleet->count; ++i){
+        float adc[SIM_SENSORS];
+        
+        for (int s = 0; s < SIM_SENSORS; ++s){
+            adc[s] = fleet->adc[s][i];
+        }
+        
+        sim_control_robot(&robots[i], adc, fleet->count_right[i], 
+                fleet->count_left[i], ticks, &fleet->duty_right[i], 
+                &fleet->duty_left[i]);
+    }
+}
+
+void sim_control_robot(struct Robot *robot, const float *adc, 
+        int count_right, int count_left, unsigned long ticks, 
+        float *duty_right, float *duty_left){
+    /*
+    Runs the firmware's sensing and control law (control.c) on one robot
+    through its own context, ticks being the TMR1 clock now. Each call takes
+    one reading of every sensor, and the control step runs once its period
+    has passed, as the ISR would flag it. A lost pattern leaves the duties
+    as they were, as it leaves the motors.
+    */
+    robot_context = robot;
+    struct IRSensor *sensor = &ROBOT->IR_1;
+    
+    for (int s = 0; s < SIM_SENSORS; ++s){
+        control_sample(sensor, (short)adc[s], ticks, count_right, 
+                count_left);
+        sensor = sensor->next_sensor;
+    }
+    
+    if (!ROBOT->control_restart && 
+            ticks - ROBOT->control_ticks < ROBOT->control_period){
+        return;
+    }
+    
+    signed char right;
+    signed char left;
+    char status = control_step(ticks, count_right, count_left, &right, 
+            &left);
+    
+    ROBOT->control_period = control_period(ROBOT->wheel_speed);
+    
+    if (status == CONTROL_BRAKE){
+        *duty_right = 0;
+        *duty_left = 0;
+    }
+    
+    else if (status != CONTROL_LOST){
+        *duty_right = right;
+        *duty_left = left;
+    }
+}
+
+void sim_drive(struct SimFleet *fleet, float dt){
+    // First order lag from the commanded duty to each wheel's speed
+    float alpha = dt / (SIM_MOTOR_TAU + dt);
+    float *restrict speed_right = fleet->speed_right;
+    float *restrict speed_left = fleet->speed_left;
+    const float *restrict duty_right = fleet->duty_right;
+    const float *restrict duty_left = fleet->duty_left;
+    const int capacity = fleet->capacity;
+    
+    for (int i = 0; i < capacity; ++i){
+        speed_right[i] += alpha *
+                (duty_right[i] * SIM_MM_S_PER_DUTY - speed_right[i]);
+        speed_left[i] += alpha *
+                (duty_left[i] * SIM_MM_S_PER_DUTY - speed_left[i]);
+    }
+}
+
+void sim_integrate(struct SimFleet *fleet, float dt){
+    integrate_lanes(fleet->capacity, dt, fleet->speed_right, fleet->speed_left,
+            fleet->x, fleet->y, fleet->cos_heading, fleet->sin_heading,
+            fleet->travel_right, fleet->travel_left, fleet->count_right,
+            fleet->count_left);
+}
+
+void sim_sample_sensors(struct SimFleet *fleet, const struct SimTrack *track,
+        const struct SimIRModel *models){
+    for (int sensor = 0; sensor < SIM_SENSORS; ++sensor){
+        // IR_1 has position 1, on the left
+        float lateral = (1 - sensor) * SIM_SENSOR_SPACING;
+        
+        sample_lanes(fleet->capacity, lateral, track, &models[sensor],
+                fleet->x, fleet->y, fleet->cos_heading, fleet->sin_heading,
+                fleet->duty_right, fleet->duty_left, fleet->noise[sensor],
+                fleet->rng, fleet->adc[sensor]);
+    }
+}
+
+static void integrate_lanes(int lanes, float dt,
+        const float *restrict speed_right, const float *restrict speed_left,
+        float *restrict x, float *restrict y, float *restrict c,
+        float *restrict s, float *restrict travel_right,
+        float *restrict travel_left, int *restrict count_right,
+        int *restrict count_left){
+    /*
+    Differential drive, one step of dt seconds. The heading vector turns by
+    the small angle w dt through its second order rotation, and a Newton
+    step pulls it back to unit length, so the loop has no trig or branches
+    and vectorizes. Position moves along the mean of the old and new
+    headings. Encoder counts follow each wheel's total travel.
+    */
+    const float counts_per_mm = (float)COUNTS_PER_REV / WHEEL_TRAVEL_MM;
+    
+    for (int i = 0; i < lanes; ++i){
+        float step_right = speed_right[i] * dt;
+        float step_left = speed_left[i] * dt;
+        float step = (step_right + step_left) * 0.5f;
+        float turn = (step_right - step_left) * (1.0f / SIM_WHEEL_BASE);
+        float turn_cos = 1.0f - turn * turn * 0.5f;
+        float c_new = c[i] * turn_cos - s[i] * turn;
+        float s_new = s[i] * turn_cos + c[i] * turn;
+        float norm = 1.5f - 0.5f * (c_new * c_new + s_new * s_new);
+        
+        c_new *= norm;
+        s_new *= norm;
+        x[i] += step * 0.5f * (c[i] + c_new);
+        y[i] += step * 0.5f * (s[i] + s_new);
+        c[i] = c_new;
+        s[i] = s_new;
+        
+        travel_right[i] += step_right;
+        travel_left[i] += step_left;
+        count_right[i] = (int)(travel_right[i] * counts_per_mm);
+        count_left[i] = (int)(travel_left[i] * counts_per_mm);
+    }
+}
+
+static void sample_lanes(int lanes, float lateral,
+        const struct SimTrack *track, const struct SimIRModel *model,
+        const float *restrict x, const float *restrict y,
+        const float *restrict c, const float *restrict s,
+        const float *restrict duty_right, const float *restrict duty_left,
+        float *restrict noise, unsigned *restrict rng, float *restrict adc){
+    /*
+    Reads the track pixel under one sensor and converts it to ADC counts.
+    Off the image reads as bare floor. The pixel is clamped onto the image
+    and the result masked instead of branching, so the fetch becomes a
+    gather, one instruction per vector on AVX2 and later. Truncation puts a
+    sensor less than a pixel past the low edges on the edge pixel.
+    
+    The noise is AR(1), driven by a per lane xorshift whose two halves sum
+    to a triangular variate of unit variance, close enough to Gaussian for
+    ADC noise and free of any branch or library call.
+    */
+    const float *restrict darkness = track->darkness;
+    const float scale = 1.0f / track->mm_per_pixel;
+    const int width = track->width;
+    const int height = track->height;
+    const float offset = model->offset;
+    const float gain = model->gain;
+    const float ar = model->noise_ar;
+    const float innovation = model->noise * sqrtf(1 - ar * ar) * 2.4494897f;
+    const float pwm = model->pwm_gain * 0.5f;
+    
+    for (int i = 0; i < lanes; ++i){
+        int col = (int)((x[i] + c[i] * SIM_SENSOR_AHEAD - s[i] * lateral) *
+                        scale);
+        int row = (int)((y[i] + s[i] * SIM_SENSOR_AHEAD + c[i] * lateral) *
+                        scale);
+        float inside = ((unsigned)col < (unsigned)width) &
+                       ((unsigned)row < (unsigned)height);
+        
+        col = col < 0 ? 0 : col > width - 1 ? width - 1 : col;
+        row = row < 0 ? 0 : row > height - 1 ? height - 1 : row;
+        unsigned r = rng[i];
+        
+        r ^= r << 13;
+        r ^= r >> 17;
+        r ^= r << 5;
+        rng[i] = r;
+        
+        float w = (int)(r & 0xFFFF) * (1.0f / 65536) + 
+                  (int)(r >> 16) * (1.0f / 65536) - 1.0f;
+        
+        noise[i] = ar * noise[i] + innovation * w;
+        adc[i] = offset + gain * inside * darkness[row * width + col] + 
+                 noise[i] + pwm * (fabsf(duty_right[i]) + fabsf(duty_left[i]));
+    }
+}
+
+int sim_blur_track(struct SimTrack *track, float sigma_mm){
+    /*
+    Blurs the track with a Gaussian of sigma_mm, the sensor spot, so a
+    single pixel fetch reads the darkness averaged over the footprint.
+    Separable, rows then columns. Returns 0 when out of memory.
+    */
+    float sigma = sigma_mm / track->mm_per_pixel;
+    
+    if (sigma <= 0){
+        return 1;
+    }
+    
+    int reach = (int)(sigma * SIM_BLUR_SIGMAS) + 1;
+    int size = track->width > track->height ? track->width : track->height;
+    float *kernel = malloc((2 * reach + 1) * sizeof(float));
+    float *line = malloc(size * sizeof(float));
+    float *blurred = malloc(size * sizeof(float));
+    float sum = 0;
+    
+    if (kernel == 0 || line == 0 || blurred == 0){
+        free(kernel);
+        free(line);
+        free(blurred);
+        return 0;
+    }
+    
+    for (int k = -reach; k <= reach; ++k){
+        kernel[k + reach] = expf(-0.5f * k * k / (sigma * sigma));
+        sum += kernel[k + reach];
+    }
+    
+    for (int k = 0; k <= 2 * reach; ++k){
+        kernel[k] /= sum;
+    }
+    
+    for (int row = 0; row < track->height; ++row){
+        float *pixels = &track->darkness[row * track->width];
+        
+        memcpy(line, pixels, track->width * sizeof(float));
+        blur_line(pixels, line, track->width, kernel, reach);
+    }
+    
+    for (int col = 0; col < track->width; ++col){
+        for (int row = 0; row < track->height; ++row){
+            line[row] = track->darkness[row * track->width + col];
+        }
+        
+        blur_line(blurred, line, track->height, kernel, reach);
+        
+        for (int row = 0; row < track->height; ++row){
+            track->darkness[row * track->width + col] = blurred[row];
+        }
+    }
+    
+    free(kernel);
+    free(line);
+    free(blurred);
+    
+    return 1;
+}
+
+int sim_load_ir_models(const char *path, struct SimIRModel *models){
+    /*
+    Reads the models written by tools/fit_ir_model.c, one line per sensor:
+    "sensor N offset V gain V spot_mm V noise V noise_ar V pwm_gain V".
+    Lines starting with # are comments. Returns the number of sensors read,
+    sensors missing from the file are left as they were.
+    */
+    FILE *file = fopen(path, "r");
+    char text[256];
+    int loaded = 0;
+    
+    if (file == 0){
+        return 0;
+    }
+    
+    while (fgets(text, sizeof(text), file)){
+        struct SimIRModel model;
+        int sensor;
+        
+        if (text[0] == '#' || sscanf(text, "sensor %d offset %f gain %f "
+                "spot_mm %f noise %f noise_ar %f pwm_gain %f", &sensor, 
+                &model.offset, &model.gain, &model.spot_mm, &model.noise, 
+                &model.noise_ar, &model.pwm_gain) != 7){
+            continue;
+        }
+        
+        if (sensor >= 0 && sensor < SIM_SENSORS){
+            models[sensor] = model;
+            ++loaded;
+        }
+    }
+    
+    fclose(file);
+    return loaded;
+}
+
+static void blur_line(float *out, const float *in, int length,
+        const float *kernel, int reach){
+    // One dimensional convolution, edges repeat the end pixel
+    for (int i = 0; i < length; ++i){
+        float sum = 0;
+        
+        for (int k = -reach; k <= reach; ++k){
+            int j = i + k < 0 ? 0 : i + k >= length ? length - 1 : i + k;
+            
+            sum += kernel[k + reach] * in[j];
+        }
+        
+        out[i] = sum;
+    }
+}
+
+static float *alloc_floats(int count){
+    // Zeroed, count is a multiple of SIM_LANES so the size is aligned
+    float *array = aligned_alloc(SIM_ALIGN, count * sizeof(float));
+    
+    if (array != 0){
+        memset(array, 0, count * sizeof(float));
+    }
+    
+    return array;
+}
+
+static int *alloc_ints(int count){
+    // Zeroed, as alloc_floats()
+    int *array = aligned_alloc(SIM_ALIGN, count * sizeof(int));
+    
+    if (array != 0){
+        memset(array, 0, count * sizeof(int));
+    }
+    
+    return array;
+}
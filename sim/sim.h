@@ -0,0 +1,104 @@
+/*
+ * File:   sim.h
+ * Author: Jack
+ * Comments: Host simulator physics and sensor models. Robots are stored as
+ *           structure-of-arrays, one array per quantity across the whole
+ *           fleet, so every kernel is a plain loop the compiler vectorizes.
+ *           Geometry and drive constants marked placeholder have not been
+ *           measured on the robot. sim_control() steers with the
+ *           firmware's own control law, one struct Robot per robot.
+ * Revision history:
+ */
+
+#ifndef SIM_H
+#define	SIM_H
+
+#include <docking.h>
+
+#define SIM_SENSORS 3           // IR_1 to IR_3, left to right
+#define SIM_LANES 16            // fleet size is padded to a multiple of this
+
+// Robot geometry in mm, x forward and y to the left of the axle center
+#define SIM_WHEEL_BASE 120.0f       // placeholder
+#define SIM_SENSOR_AHEAD 60.0f      // placeholder
+#define SIM_SENSOR_SPACING 15.0f    // placeholder, between neighbours
+
+// Drive model, wheel speed follows duty * SIM_MM_S_PER_DUTY with a lag
+#define SIM_MM_S_PER_DUTY ((float)CRUISE_SPEED / CRUISE_DUTY)
+#define SIM_MOTOR_TAU 0.05f         // s, placeholder
+
+// Track image of line darkness, 0 bare floor to 1 on the line. Stored as
+// floats since vector gathers fetch 32 bit elements
+struct SimTrack
+{
+    int width;
+    int height;
+    float mm_per_pixel;
+    float *darkness;            // row major, y up
+};
+
+/*
+One sensor, fitted to recorded readings by tools/fit_ir_model.c. The ADC
+reads offset + gain * darkness of the track under the spot, plus AR(1)
+noise and interference that grows with the motor duty. The spot is applied
+once by blurring the track with sim_blur_track().
+*/
+struct SimIRModel
+{
+    float offset;               // counts on bare floor
+    float gain;                 // counts from bare floor to full line
+    float spot_mm;              // footprint, standard deviation
+    float noise;                // counts rms
+    float noise_ar;             // sample to sample correlation, 0 is white
+    float pwm_gain;             // counts per percent of mean motor duty
+};
+
+struct SimFleet
+{
+    int count;                  // robots in use
+    int capacity;               // count rounded up to SIM_LANES
+    
+    // Pose, heading kept as a unit vector so no trig is needed per step
+    float *x;
+    float *y;
+    float *cos_heading;
+    float *sin_heading;
+    
+    // Drive, duty in percent as the firmware sets it, speeds in mm/s
+    float *duty_right;
+    float *duty_left;
+    float *speed_right;
+    float *speed_left;
+    
+    // Odometry, travel in mm and the encoder counts it gives
+    float *travel_right;
+    float *travel_left;
+    int *count_right;
+    int *count_left;
+    
+    float *adc[SIM_SENSORS];    // latest reading of each sensor
+    float *noise[SIM_SENSORS];  // noise state of each sensor
+    unsigned *rng;              // xorshift state
+};
+
+int sim_alloc_fleet(struct SimFleet *, int);
+void sim_free_fleet(struct SimFleet *);
+void sim_place(struct SimFleet *, int, float, float, float);
+int sim_alloc_track(struct SimTrack *, int, int, float);
+void sim_free_track(struct SimTrack *);
+void sim_draw_oval(struct SimTrack *, float, float, float);
+int sim_blur_track(struct SimTrack *, float);
+int sim_load_ir_models(const char *, struct SimIRModel *);
+
+struct Robot;
+
+void sim_start_control(struct SimFleet *, struct Robot *);
+void sim_control(struct SimFleet *, struct Robot *, unsigned long);
+void sim_control_robot(struct Robot *, const float *, int, int, 
+        unsigned long, float *, float *);
+void sim_drive(struct SimFleet *, float);
+void sim_integrate(struct SimFleet *, float);
+void sim_sample_sensors(struct SimFleet *, const struct SimTrack *,
+        const struct SimIRModel *);     // one model per sensor
+
+#endif
@@ -0,0 +1,220 @@
+/*
+ * File:   sim_bench.c
+ * Author: Jack
+ *
+ * Created on December 23, 2020, 2:30 PM
+ *
+ * Host tool. Steps a fleet of robots round an oval track with the batched
+ * kernels in sim.c and reports robot-steps per second on one core, against
+ * a plain per-robot loop of the same physics with one struct per robot.
+ * Both steer every robot with the firmware's own control law (control.c),
+ * one struct Robot each, so the figures include it. The sensors are ideal
+ * unless a model file from tools/fit_ir_model.c is given.
+ *
+ * Build: cc -O3 -march=native -Iheaders -Isim -o sim_bench sim/sim_bench.c
+ *            sim/sim.c src/control.c src/sensor_health.c src/robot.c
+ *            src/docking.c src/heading_hold.c src/position_hold.c
+ *            src/speed_profile.c src/speed_table.c src/line_offset.c
+ *            src/line_loss.c src/latency_comp.c src/freq_response.c
+ *            src/fixed_math.c src/sample_rates.c -lm
+ * Usage: sim_bench [robots] [steps] [models]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <time.h>
+#include <encoders.h>
+#include <clock.h>
+#include <robot.h>
+#include <control.h>
+#include <sim.h>
+
+#define DT 0.002f               // s per step, every sensor read each step
+#define STEP_TICKS ((unsigned long)(DT * TMR1_HZ + 0.5f))
+#define TRACK_MM 2000
+#define MM_PER_PIXEL 1.0f
+#define OVAL_X 800.0f
+#define OVAL_Y 500.0f
+#define LINE_MM 19.0f
+
+struct ScalarRobot
+{
+    float x, y, heading;
+    float duty_right, duty_left;
+    float speed_right, speed_left;
+    float travel_right, travel_left;
+    int count_right, count_left;
+    float adc[SIM_SENSORS];
+};
+
+static double now(void){
+    struct timespec t;
+    
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + t.tv_nsec * 1e-9;
+}
+
+static void step_scalar(struct ScalarRobot *robot, struct Robot *firmware,
+        const struct SimTrack *track, const struct SimIRModel *models,
+        unsigned long ticks){
+    // The same model written the obvious way, one robot at a time
+    float alpha = DT / (SIM_MOTOR_TAU + DT);
+    
+    robot->speed_right += alpha *
+            (robot->duty_right * SIM_MM_S_PER_DUTY - robot->speed_right);
+    robot->speed_left += alpha *
+            (robot->duty_left * SIM_MM_S_PER_DUTY - robot->speed_left);
+    
+    float step_right = robot->speed_right * DT;
+    float step_left = robot->speed_left * DT;
+    float step = (step_right + step_left) / 2;
+    float turn = (step_right - step_left) / SIM_WHEEL_BASE;
+    
+    robot->x += step * cosf(robot->heading + turn / 2);
+    robot->y += step * sinf(robot->heading + turn / 2);
+    robot->heading += turn;
+    robot->travel_right += step_right;
+    robot->travel_left += step_left;
+    robot->count_right = (int)(robot->travel_right * COUNTS_PER_REV /
+                               WHEEL_TRAVEL_MM);
+    robot->count_left = (int)(robot->travel_left * COUNTS_PER_REV /
+                              WHEEL_TRAVEL_MM);
+    
+    for (int s = 0; s < SIM_SENSORS; ++s){
+        float lateral = (1 - s) * SIM_SENSOR_SPACING;
+        float c = cosf(robot->heading);
+        float n = sinf(robot->heading);
+        int col = (int)floorf((robot->x + c * SIM_SENSOR_AHEAD - n * lateral) /
+                              track->mm_per_pixel);
+        int row = (int)floorf((robot->y + n * SIM_SENSOR_AHEAD + c * lateral) /
+                              track->mm_per_pixel);
+        float darkness = 0;
+        
+        if (col >= 0 && row >= 0 && col < track->width && row < track->height){
+            darkness = track->darkness[row * track->width + col];
+        }
+        
+        robot->adc[s] = models[s].offset + models[s].gain * darkness;
+    }
+    
+    sim_control_robot(firmware, robot->adc, robot->count_right, 
+            robot->count_left, ticks, &robot->duty_right, &robot->duty_left);
+}
+
+int main(int argc, char *argv[]){
+    int robots = argc > 1 ? atoi(argv[1]) : 4096;
+    int steps = argc > 2 ? atoi(argv[2]) : 2000;
+    struct SimTrack track;
+    struct SimFleet fleet;
+    struct SimIRModel models[SIM_SENSORS];
+    int size = (int)(TRACK_MM / MM_PER_PIXEL);
+    
+    for (int s = 0; s < SIM_SENSORS; ++s){
+        models[s] = (struct SimIRModel){600.0f, 3300.0f, 0, 0, 0, 0};
+    }
+    
+    if (robots < 1 || steps < 1 || !sim_alloc_track(&track, size, size,
+            MM_PER_PIXEL) || !sim_alloc_fleet(&fleet, robots) ||
+            (argc > 3 && !sim_load_ir_models(argv[3], models))){
+        fprintf(stderr, "usage: sim_bench [robots] [steps] [models]\n");
+        return 1;
+    }
+    
+    // One blur serves all three sensors, their spots are near enough equal
+    sim_draw_oval(&track, OVAL_X, OVAL_Y, LINE_MM);
+    sim_blur_track(&track, models[1].spot_mm);
+    
+    // Spread the fleet round the loop, each on the line and facing along it
+    struct ScalarRobot *scalar = calloc(fleet.capacity, sizeof(*scalar));
+    struct Robot *firmware = malloc(fleet.capacity * sizeof(*firmware));
+    struct Robot *scalar_firmware = malloc(fleet.capacity * sizeof(*firmware));
+    
+    if (scalar == 0 || firmware == 0 || scalar_firmware == 0){
+        fprintf(stderr, "out of memory\n");
+        return 1;
+    }
+    
+    
+    for (int i = 0; i < fleet.capacity; ++i){
+        float angle = 6.2831853f * i / fleet.capacity;
+        float x = TRACK_MM / 2 + OVAL_X * cosf(angle);
+        float y = TRACK_MM / 2 + OVAL_Y * sinf(angle);
+        float heading = atan2f(OVAL_Y * cosf(angle), -OVAL_X * sinf(angle));
+        
+        sim_place(&fleet, i, x - SIM_SENSOR_AHEAD * cosf(heading),
+                y - SIM_SENSOR_AHEAD * sinf(heading), heading);
+        fleet.duty_right[i] = CRUISE_DUTY;
+        fleet.duty_left[i] = CRUISE_DUTY;
+        scalar[i].x = fleet.x[i];
+        scalar[i].y = fleet.y[i];
+        scalar[i].heading = heading;
+        scalar[i].duty_right = CRUISE_DUTY;
+        scalar[i].duty_left = CRUISE_DUTY;
+    }
+    
+    // Padding lanes run the firmware too, the scalar loop steps them all
+    int count = fleet.count;
+    
+    fleet.count = fleet.capacity;
+    sim_start_control(&fleet, firmware);
+    sim_start_control(&fleet, scalar_firmware);
+    
+    double kernel_s = 0;
+    double start = now();
+    
+    for (int step = 0; step < steps; ++step){
+        double kernel_start = now();
+        
+        sim_drive(&fleet, DT);
+        sim_integrate(&fleet, DT);
+        sim_sample_sensors(&fleet, &track, models);
+        kernel_s += now() - kernel_start;
+        sim_control(&fleet, firmware, (step + 1) * STEP_TICKS);
+    }
+    
+    double batched_s = now() - start;
+    
+    start = now();
+    
+    for (int step = 0; step < steps; ++step){
+        for (int i = 0; i < fleet.capacity; ++i){
+            step_scalar(&scalar[i], &scalar_firmware[i], &track, models, 
+                    (step + 1) * STEP_TICKS);
+        }
+    }
+    
+    double scalar_s = now() - start;
+    
+    fleet.count = count;
+    
+    // Robots still with a sensor on the line, a check the physics is sane
+    int on_line = 0;
+    
+    for (int i = 0; i < robots; ++i){
+        on_line += fleet.adc[0][i] >= ADC_CUTOFF ||
+                   fleet.adc[1][i] >= ADC_CUTOFF ||
+                   fleet.adc[2][i] >= ADC_CUTOFF;
+    }
+    
+    double work = (double)fleet.capacity * steps;
+    
+    printf("robots             %d (%d lanes)\n", robots, fleet.capacity);
+    printf("steps              %d of %.0f ms\n", steps, DT * 1000);
+    printf("batched            %.1f M robot-steps/s per core\n",
+            work / batched_s * 1e-6);
+    printf("  kernels only     %.1f M robot-steps/s per core\n",
+            work / kernel_s * 1e-6);
+    printf("scalar             %.1f M robot-steps/s per core\n",
+            work / scalar_s * 1e-6);
+    printf("speedup            %.1fx\n", scalar_s / batched_s);
+    printf("on the line        %d of %d at the end\n", on_line, robots);
+    
+    free(scalar);
+    free(firmware);
+    free(scalar_firmware);
+    sim_free_fleet(&fleet);
+    sim_free_track(&track);
+    
+    return 0;
+}
@@ -0,0 +1,102 @@
+/*
+ * File:   sim_traffic.c
+ * Author: Jack
+ *
+ * Created on December 27, 2020, 3:00 PM
+ *
+ * Host tool. Runs the fleet on a shared line network (network.h) at every
+ * fleet size from 1 to max_robots under each dispatch policy, and prints
+ * deliveries per hour, robot utilization, how long jobs wait for a robot
+ * and how much of the time robots are held up by each other, as CSV for
+ * capacity planning. Without a network file it uses a loop of 6 stations
+ * on sidings, 1.5 m apart. Every robot runs the firmware's control law
+ * (control.c) on its own context and docks through it; its position on
+ * the line, the sensor readings and the path between stations are
+ * modelled. service_s is how long a robot stays docked at each pickup and
+ * drop, and goes in every row, as it has not been timed at a station.
+ *
+ * Build: cc -O2 -Iheaders -Isim -o sim_traffic sim/sim_traffic.c
+ *            sim/network.c src/control.c src/sensor_health.c src/robot.c
+ *            src/docking.c src/heading_hold.c src/position_hold.c
+ *            src/speed_profile.c src/speed_table.c src/line_offset.c
+ *            src/line_loss.c src/latency_comp.c src/freq_response.c
+ *            src/fixed_math.c src/sample_rates.c -lm
+ * Usage: sim_traffic [max_robots] [jobs_per_h] [service_s] [network.txt]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <network.h>
+
+#define DT 0.01f                // s per step
+#define WARM_UP_S 600.0f        // s run before counting
+#define MEASURE_S 3600.0f       // s counted
+#define STATIONS 6
+#define SPACING_MM 1500.0f
+#define SEED 12345
+
+// Whole steps, a float time accumulated by DT drifts off the target
+#define WARM_UP_STEPS ((long)(WARM_UP_S / DT + 0.5f))
+#define MEASURE_STEPS ((long)(MEASURE_S / DT + 0.5f))
+
+static const char *policy_names[] = {"fifo", "nearest"};
+
+int main(int argc, char *argv[]){
+    int max_robots = argc > 1 ? atoi(argv[1]) : 16;
+    float jobs_per_h = argc > 2 ? (float)atof(argv[2]) : 400.0f;
+    float service_s = argc > 3 ? (float)atof(argv[3]) : 10.0f;
+    static struct SimNetwork network;
+    static struct SimTraffic traffic;
+    
+    if (argc > 4){
+        if (!sim_load_network(&network, argv[4])){
+            fprintf(stderr, "cannot read %s\n", argv[4]);
+            return 1;
+        }
+    }
+    else {
+        sim_loop_network(&network, STATIONS, SPACING_MM);
+    }
+    
+    if (max_robots < 1 || max_robots > SIM_ROBOTS || jobs_per_h <= 0 ||
+            service_s < 0 || !sim_route_network(&network)){
+        fprintf(stderr, "usage: sim_traffic [max_robots] [jobs_per_h] "
+                "[service_s] [network.txt], stations must be reachable "
+                "from every node\n");
+        return 1;
+    }
+    
+    printf("policy,robots,service_s,deliveries_per_h,utilization,wait_s,"
+           "blocked,turned_away\n");
+    
+    for (int policy = SIM_POLICY_FIFO; policy <= SIM_POLICY_NEAREST;
+            ++policy){
+        for (int robots = 1; robots <= max_robots; ++robots){
+            sim_start_traffic(&traffic, &network, robots, (char)policy,
+                    jobs_per_h, service_s, SEED);
+            
+            for (long step = 0; step < WARM_UP_STEPS; ++step){
+                sim_step_traffic(&traffic, DT);
+            }
+            
+            sim_clear_traffic_stats(&traffic);
+            
+            for (long step = 0; step < MEASURE_STEPS; ++step){
+                sim_step_traffic(&traffic, DT);
+            }
+            
+            double measured_s = traffic.time - traffic.stats_start;
+            double robot_s = measured_s * robots;
+            
+            printf("%s,%d,%.1f,%.1f,%.3f,%.1f,%.3f,%lu\n", 
+                    policy_names[policy], robots, service_s, 
+                    traffic.deliveries * 3600.0 / measured_s,
+                    traffic.busy_s / robot_s,
+                    traffic.pickups ? traffic.wait_s / traffic.pickups : 0,
+                    traffic.blocked_s / robot_s, traffic.turned_away);
+            fflush(stdout);
+        }
+    }
+    
+    return 0;
+}
@@ -0,0 +1,168 @@
+/*
+ * File:   sim_whatif.c
+ * Author: Jack
+ *
+ * Created on December 24, 2020, 2:15 PM
+ *
+ * Host tool. Drives one robot part way round the oval, snapshots it and
+ * forks the snapshot into a fleet where every copy is knocked off its
+ * heading by a different angle, as if the line were lost at that instant.
+ * Reports how many copies find the line again for each size of knock, and
+ * what the fork cost against re-running every copy from the start. Every
+ * robot runs the firmware's control law (sim_control()), and each copy
+ * gets its own copy of the firmware state with the physics, so the sensor
+ * health, heading hold and loss predictor carry on from the snapshot. The
+ * button and pause logic is still in main.c and does not run here.
+ *
+ * Build: cc -O3 -march=native -Iheaders -Isim -o sim_whatif
+ *            sim/sim_whatif.c sim/snapshot.c sim/sim.c src/control.c
+ *            src/sensor_health.c src/robot.c src/docking.c
+ *            src/heading_hold.c src/position_hold.c src/speed_profile.c
+ *            src/speed_table.c src/line_offset.c src/line_loss.c
+ *            src/latency_comp.c src/freq_response.c src/fixed_math.c
+ *            src/sample_rates.c -lm
+ * Usage: sim_whatif [copies] [lead_s] [models]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <time.h>
+#include <clock.h>
+#include <control.h>
+#include <snapshot.h>
+
+#define DT 0.002f               // s per step, every sensor read each step
+#define STEP_TICKS ((unsigned long)(DT * TMR1_HZ + 0.5f))
+#define TRACK_MM 2000
+#define OVAL_X 800.0f
+#define OVAL_Y 500.0f
+#define LINE_MM 19.0f
+#define KICK_MAX 1.0f           // rad, largest knock off heading
+#define AFTER_S 2.0f            // s run after the knock
+#define BUCKETS 8
+
+static double now(void){
+    struct timespec t;
+    
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + t.tv_nsec * 1e-9;
+}
+
+static void run(struct SimFleet *fleet, struct Robot *robots,
+        const struct SimTrack *track, const struct SimIRModel *models,
+        int first, int steps){
+    // Steps first + 1 to first + steps, the clock carries on across forks
+    for (int step = first + 1; step <= first + steps; ++step){
+        sim_drive(fleet, DT);
+        sim_integrate(fleet, DT);
+        sim_sample_sensors(fleet, track, models);
+        sim_control(fleet, robots, step * STEP_TICKS);
+    }
+}
+
+static void start_on_line(struct SimFleet *fleet, int first, int count){
+    // At the right hand end of the oval heading anticlockwise at cruise
+    for (int i = first; i < first + count; ++i){
+        sim_place(fleet, i, TRACK_MM / 2 + OVAL_X, 
+                TRACK_MM / 2 - SIM_SENSOR_AHEAD, 1.5707963f);
+        fleet->duty_right[i] = CRUISE_DUTY;
+        fleet->duty_left[i] = CRUISE_DUTY;
+    }
+}
+
+int main(int argc, char *argv[]){
+    int copies = argc > 1 ? atoi(argv[1]) : 4096;
+    float lead_s = argc > 2 ? (float)atof(argv[2]) : 3.0f;
+    int lead_steps = (int)(lead_s / DT);
+    struct SimTrack track;
+    struct SimFleet one;
+    struct SimFleet fleet;
+    struct SimIRModel models[SIM_SENSORS];
+    struct SimSnapshot snapshot;
+    struct Robot robot;
+    struct Robot *robots = malloc(copies * sizeof(struct Robot));
+    
+    for (int s = 0; s < SIM_SENSORS; ++s){
+        models[s] = (struct SimIRModel){600.0f, 3300.0f, 0, 0, 0, 0};
+    }
+    
+    if (copies < 1 || robots == 0 || 
+            !sim_alloc_track(&track, TRACK_MM, TRACK_MM, 1.0f) ||
+            !sim_alloc_fleet(&one, 1) || !sim_alloc_fleet(&fleet, copies) ||
+            (argc > 3 && !sim_load_ir_models(argv[3], models))){
+        fprintf(stderr, "usage: sim_whatif [copies] [lead_s] [models]\n");
+        return 1;
+    }
+    
+    sim_draw_oval(&track, OVAL_X, OVAL_Y, LINE_MM);
+    sim_blur_track(&track, models[1].spot_mm);
+    
+    start_on_line(&one, 0, 1);
+    sim_start_control(&one, &robot);
+    run(&one, &robot, &track, models, 0, lead_steps);
+    
+    if (!sim_take_snapshot(&snapshot, &one, &robot, lead_s)){
+        fprintf(stderr, "out of memory\n");
+        return 1;
+    }
+    
+    double start = now();
+    
+    sim_fork(&snapshot, 0, &fleet, robots, 0, copies);
+    
+    double fork_s = now() - start;
+    
+    // The alternative, every copy driven from the start again
+    start = now();
+    start_on_line(&fleet, 0, copies);
+    sim_start_control(&fleet, robots);
+    run(&fleet, robots, &track, models, 0, lead_steps);
+    
+    double rerun_s = now() - start;
+    
+    sim_fork(&snapshot, 0, &fleet, robots, 0, copies);
+    
+    for (int i = 0; i < copies; ++i){
+        float kick = KICK_MAX * i / copies;
+        float c = fleet.cos_heading[i];
+        float s = fleet.sin_heading[i];
+        
+        fleet.cos_heading[i] = c * cosf(kick) - s * sinf(kick);
+        fleet.sin_heading[i] = s * cosf(kick) + c * sinf(kick);
+    }
+    
+    run(&fleet, robots, &track, models, lead_steps, (int)(AFTER_S / DT));
+    
+    int found[BUCKETS] = {0};
+    int tried[BUCKETS] = {0};
+    
+    for (int i = 0; i < copies; ++i){
+        int bucket = i * BUCKETS / copies;
+        
+        ++tried[bucket];
+        found[bucket] += fleet.adc[0][i] >= ADC_CUTOFF ||
+                         fleet.adc[1][i] >= ADC_CUTOFF ||
+                         fleet.adc[2][i] >= ADC_CUTOFF;
+    }
+    
+    printf("forked %d copies at %.1f s\n", copies, snapshot.time);
+    printf("fork               %.3f ms, %.0f ns per copy\n", fork_s * 1e3, 
+            fork_s * 1e9 / copies);
+    printf("re-run from start  %.3f ms, %.0fx the fork\n", rerun_s * 1e3, 
+            rerun_s / fork_s);
+    printf("knock_deg,on_line_after_%.0fs\n", AFTER_S);
+    
+    for (int b = 0; b < BUCKETS; ++b){
+        printf("%.0f-%.0f,%d/%d\n", KICK_MAX * b / BUCKETS * 57.29578f,
+                KICK_MAX * (b + 1) / BUCKETS * 57.29578f, found[b], tried[b]);
+    }
+    
+    sim_free_snapshot(&snapshot);
+    sim_free_fleet(&one);
+    sim_free_fleet(&fleet);
+    sim_free_track(&track);
+    free(robots);
+    
+    return 0;
+}
@@ -0,0 +1,135 @@
+/*
+ * File:   snapshot.c
+ * Author: Jack
+ *
+ * Created on December 24, 2020, 11:00 AM
+ */
+
+#include <stdlib.h>
+#include <snapshot.h>
+
+static void read_lane(const struct SimFleet *, int, struct SimLane *);
+static void write_lane(struct SimFleet *, int, const struct SimLane *);
+
+int sim_take_snapshot(struct SimSnapshot *snapshot,
+        const struct SimFleet *fleet, const struct Robot *robots,
+        double time){
+    /*
+    Copies every robot in the fleet, and its firmware context when robots
+    is not 0. Returns 0 when out of memory.
+    */
+    snapshot->count = fleet->count;
+    snapshot->time = time;
+    snapshot->lanes = malloc(fleet->count * sizeof(struct SimLane));
+    snapshot->robots = 0;
+    
+    if (snapshot->lanes == 0){
+        return 0;
+    }
+    
+    for (int i = 0; i < fleet->count; ++i){
+        read_lane(fleet, i, &snapshot->lanes[i]);
+    }
+    
+    if (robots != 0){
+        snapshot->robots = malloc(fleet->count * sizeof(struct Robot));
+        
+        if (snapshot->robots == 0){
+            sim_free_snapshot(snapshot);
+            return 0;
+        }
+        
+        for (int i = 0; i < fleet->count; ++i){
+            copy_robot(&snapshot->robots[i], &robots[i]);
+        }
+    }
+    
+    return 1;
+}
+
+void sim_restore_snapshot(const struct SimSnapshot *snapshot,
+        struct SimFleet *fleet, struct Robot *robots){
+    // Puts the fleet back as it was, fleet must hold snapshot->count robots
+    for (int i = 0; i < snapshot->count; ++i){
+        write_lane(fleet, i, &snapshot->lanes[i]);
+        
+        if (robots != 0 && snapshot->robots != 0){
+            copy_robot(&robots[i], &snapshot->robots[i]);
+        }
+    }
+}
+
+void sim_fork(const struct SimSnapshot *snapshot, int robot,
+        struct SimFleet *fleet, struct Robot *robots, int first, int copies){
+    /*
+    Fills lanes first to first + copies - 1 with one robot of the snapshot,
+    and the same robots with its firmware context when both have one, ready
+    for each to be perturbed into its own scenario and stepped on together
+    with the batched kernels. Each copy gets its own noise stream
+    from then on, the xorshift state must not be 0.
+    */
+    for (int i = first; i < first + copies; ++i){
+        write_lane(fleet, i, &snapshot->lanes[robot]);
+        fleet->rng[i] ^= 2654435761u * (i + 1);
+        
+        if (fleet->rng[i] == 0){
+            fleet->rng[i] = 1;
+        }
+        
+        if (robots != 0 && snapshot->robots != 0){
+            copy_robot(&robots[i], &snapshot->robots[robot]);
+        }
+    }
+}
+
+void sim_free_snapshot(struct SimSnapshot *snapshot){
+    free(snapshot->lanes);
+    free(snapshot->robots);
+    snapshot->lanes = 0;
+    snapshot->robots = 0;
+    snapshot->count = 0;
+}
+
+static void read_lane(const struct SimFleet *fleet, int i,
+        struct SimLane *lane){
+    lane->x = fleet->x[i];
+    lane->y = fleet->y[i];
+    lane->cos_heading = fleet->cos_heading[i];
+    lane->sin_heading = fleet->sin_heading[i];
+    lane->duty_right = fleet->duty_right[i];
+    lane->duty_left = fleet->duty_left[i];
+    lane->speed_right = fleet->speed_right[i];
+    lane->speed_left = fleet->speed_left[i];
+    lane->travel_right = fleet->travel_right[i];
+    lane->travel_left = fleet->travel_left[i];
+    lane->count_right = fleet->count_right[i];
+    lane->count_left = fleet->count_left[i];
+    lane->rng = fleet->rng[i];
+    
+    for (int s = 0; s < SIM_SENSORS; ++s){
+        lane->adc[s] = fleet->adc[s][i];
+        lane->noise[s] = fleet->noise[s][i];
+    }
+}
+
+static void write_lane(struct SimFleet *fleet, int i,
+        const struct SimLane *lane){
+    fleet->x[i] = lane->x;
+    fleet->y[i] = lane->y;
+    fleet->cos_heading[i] = lane->cos_heading;
+    fleet->sin_heading[i] = lane->sin_heading;
+    fleet->duty_right[i] = lane->duty_right;
+    fleet->duty_left[i] = lane->duty_left;
+    fleet->speed_right[i] = lane->speed_right;
+    fleet->speed_left[i] = lane->speed_left;
+    fleet->travel_right[i] = lane->travel_right;
+    fleet->travel_left[i] = lane->travel_left;
+    fleet->count_right[i] = lane->count_right;
+    fleet->count_left[i] = lane->count_left;
+    fleet->rng[i] = lane->rng;
+    
+    for (int s = 0; s < SIM_SENSORS; ++s){
+        fleet->adc[s][i] = lane->adc[s];
+        fleet->noise[s][i] = lane->noise[s];
+    }
+}
@@ -0,0 +1,54 @@
+/*
+ * File:   snapshot.h
+ * Author: Jack
+ * Comments: Snapshots of a simulated fleet, physics, sensor noise and
+ *           firmware state together, that can be restored or forked into
+ *           many lanes to branch scenarios from one instant. A robot's
+ *           physics is about 80 bytes and its firmware a struct Robot, so
+ *           a snapshot is a compact copy rather than shared pages.
+ * Revision history:
+ */
+
+#ifndef SNAPSHOT_H
+#define	SNAPSHOT_H
+
+#include <sim.h>
+#include <robot.h>
+
+// Everything one lane of a SimFleet holds
+struct SimLane
+{
+    float x;
+    float y;
+    float cos_heading;
+    float sin_heading;
+    float duty_right;
+    float duty_left;
+    float speed_right;
+    float speed_left;
+    float travel_right;
+    float travel_left;
+    int count_right;
+    int count_left;
+    float adc[SIM_SENSORS];
+    float noise[SIM_SENSORS];
+    unsigned rng;
+};
+
+struct SimSnapshot
+{
+    int count;
+    double time;                // s, simulated time it was taken at
+    struct SimLane *lanes;
+    struct Robot *robots;       // firmware state, 0 when not simulated
+};
+
+int sim_take_snapshot(struct SimSnapshot *, const struct SimFleet *,
+        const struct Robot *, double);
+void sim_restore_snapshot(const struct SimSnapshot *, struct SimFleet *,
+        struct Robot *);
+void sim_fork(const struct SimSnapshot *, int, struct SimFleet *,
+        struct Robot *, int, int);
+void sim_free_snapshot(struct SimSnapshot *);
+
+#endif
@@ -0,0 +1,94 @@
+/*
+ * File:   clock.c
+ * Author: Jack
+ *
+ * Created on December 13, 2020, 5:10 PM
+ */
+
+#include <xc.h>
+#include <pic18f87k22.h>
+#include <clock.h>
+
+// 131072us per overflow, as an exact fraction of a second
+#define OVERFLOW_NUM 2048UL
+#define OVERFLOW_DEN 15625UL
+
+__persistent unsigned long clock_overflows;     // kept over a warm restart
+
+static unsigned long scale_overflows(unsigned long);
+
+void init_clock(char warm){
+    /*
+    TMR1 is already running for the CCP timesteps, this only counts its
+    overflows. The count is cleared unless resuming after a warm restart.
+    */
+    if (!warm){
+        clock_overflows = 0;
+    }
+    
+    PIR1bits.TMR1IF = 0;        // clear
+    IPR1bits.TMR1IP = 0;        // low pri
+    PIE1bits.TMR1IE = 1;        // enable
+}
+
+unsigned long read_clock_overflows(){
+    // The ISR updates the count a byte at a time, hold it off while copying
+    PIE1bits.TMR1IE = 0;
+    unsigned long overflows = clock_overflows;
+    PIE1bits.TMR1IE = 1;
+    
+    return overflows;
+}
+
+unsigned long read_clock_ticks(){
+    /*
+    Free running TMR1 count extended with the overflows, 2us per tick. An
+    overflow that happened after interrupts were held off is still pending
+    in TMR1IF and is counted here.
+    */
+    PIE1bits.TMR1IE = 0;
+    unsigned long overflows = clock_overflows;
+    unsigned short ticks = read_TMR1();
+    
+    if (PIR1bits.TMR1IF && ticks < 0x8000){
+        ++overflows;
+    }
+    
+    PIE1bits.TMR1IE = 1;
+    
+    return (overflows << 16) | ticks;
+}
+
+unsigned short read_TMR1(){
+    // TMR1 is in 8-bit read mode, re-read if the low byte rolled over
+    char high;
+    char low;
+    
+    do {
+        high = TMR1H;
+        low = TMR1L;
+    } while (high != TMR1H);
+    
+    return ((unsigned short)high << 8) | low;
+}
+
+unsigned short clock_seconds(){
+    return (unsigned short)scale_overflows(OVERFLOW_NUM);
+}
+
+unsigned short clock_deciseconds(){
+    return (unsigned short)scale_overflows(OVERFLOW_NUM * 10);
+}
+
+static unsigned long scale_overflows(unsigned long num){
+    /*
+    Uptime in units of 1 / (num / OVERFLOW_NUM) s. Whole OVERFLOW_DEN
+    blocks are scaled after dividing and only the remainder before, so the
+    product stays in 32 bits for the whole uptime instead of wrapping after
+    7.6h at deciseconds. The callers keep the low 16 bits.
+    */
+    unsigned long overflows = read_clock_overflows();
+    
+    return overflows / OVERFLOW_DEN * num + 
+           overflows % OVERFLOW_DEN * num / OVERFLOW_DEN;
+}
@@ -0,0 +1,293 @@
+/*
+ * File:   control.c
+ * Author: Jack
+ *
+ * Created on January 3, 2021, 9:30 AM
+ */
+
+#include <control.h>
+#include <robot.h>
+#include <sensor_health.h>
+#include <sample_rates.h>
+#include <line_offset.h>
+#include <clock.h>
+
+#define DEGRADED_NUM 3      // duty cycle scale while a sensor has failed
+#define DEGRADED_DEN 4
+#define CONTROL_ELAPSED_MAX (4 * CONTROL_PERIOD_MAX)    // longest step counted
+
+static char convert_array_to_inputs(signed char *, signed char *, const char);
+
+void init_control(){
+    // Power on state of the control features, as built in control.h
+    init_heading_hold(&ROBOT->heading, HEADING_HOLD);
+    init_position_hold(&ROBOT->position_hold, POSITION_HOLD);
+    init_speed_profile(&ROBOT->profile, SPEED_PROFILE);
+    init_loss_predictor(&ROBOT->loss, LOSS_PREDICT, LOSS_HORIZON_MS,
+            ADC_CUTOFF);
+    init_latency_comp(&ROBOT->latency, LATENCY_COMP);
+}
+
+void start_control(char resume, int count_right, int count_left){
+    /*
+    Called as a delivery starts, or resumes after a pause. A new delivery
+    looks for its marker and follows its speed plan from the start.
+    */
+    if (!resume){
+        reset_docking(&ROBOT->docking);
+        start_speed_profile(&ROBOT->profile, count_right, count_left);
+    }
+    
+    // every start gives the sensors a fresh health record
+    reset_sensor_health(&ROBOT->IR_1);
+    ROBOT->IR_failed = 0;
+    release_position_hold(&ROBOT->position_hold);
+}
+
+void control_sample(struct IRSensor *sensor, short reading,
+        unsigned long ticks, int count_right, int count_left){
+    /*
+    Takes one processed reading of sensor, made at ticks with the wheels at
+    the given counts. Updates the pattern and the sensor health, stamps the
+    sample for reprojection and watches for the stop marker.
+    */
+    if (reading >= ADC_CUTOFF){
+        ROBOT->IR_temp_array |= 1 << sensor->index;        // set bit
+    }
+    
+    else {
+        ROBOT->IR_temp_array &= ~(1 << sensor->index);     // clear bit
+    }
+    
+    ++sensor->samples;
+    check_sensor_reading(sensor, reading);
+    check_pattern_health(&ROBOT->IR_1, ROBOT->IR_temp_array,
+            ROBOT->IR_meas_array, ticks);
+    ROBOT->IR_failed = get_failed_sensors(&ROBOT->IR_1);
+    
+    // The scan order is adaptive, so every sample updates it
+    ROBOT->IR_meas_array = ROBOT->IR_temp_array;
+    
+    // Stamp the sample, the frame is reprojected from these
+    sensor->sample_ticks = ticks;
+    sensor->sample_count_right = count_right;
+    sensor->sample_count_left = count_left;
+    mark_latency_sample(&ROBOT->latency, ticks, count_right, count_left);
+    
+    if (ROBOT->docking.state <= DOCK_ARMED){
+        // find the marker's leading edge at the full sample rate
+        char meas = mask_failed_sensors(ROBOT->IR_meas_array,
+                ROBOT->IR_failed);
+        
+        update_dock_marker(&ROBOT->docking, meas == 0b111, count_right,
+                count_left);
+    }
+}
+
+char control_step(unsigned long ticks, int count_right, int count_left,
+        signed char *right, signed char *left){
+    /*
+    Runs every CONTROL timestep with the clock and encoder counts read at
+    its start. Sets the wheel duties from the latest measurement array, or
+    holds position while paused, and returns what to do with the motors,
+    one of the CONTROL_ values.
+    */
+    signed char DCRight;
+    signed char DCLeft;
+    char status;
+    
+    if (ROBOT->control_restart){
+        // first step after a pause, the last one saved is from before it
+        ROBOT->control_restart = 0;
+        ROBOT->control_ticks = ticks - ROBOT->control_period;
+        ROBOT->control_count_right = count_right;
+        ROBOT->control_count_left = count_left;
+    }
+    
+    unsigned long elapsed = ticks - ROBOT->control_ticks;
+    
+    if (elapsed > CONTROL_ELAPSED_MAX){
+        // main loop held up, keep the scaling below in range
+        elapsed = CONTROL_ELAPSED_MAX;
+    }
+    
+    unsigned short elapsed_ms = (unsigned short)(elapsed * 1000 / TMR1_HZ);
+    long counts = ((long)(count_right - ROBOT->control_count_right) +
+                   (count_left - ROBOT->control_count_left)) / 2;
+    
+    ROBOT->wheel_speed = (int)(counts * (long)TMR1_HZ / (long)elapsed *
+                        WHEEL_TRAVEL_MM / COUNTS_PER_REV);
+    ROBOT->control_count_right = count_right;
+    ROBOT->control_count_left = count_left;
+    ROBOT->control_ticks = ticks;
+    
+    if (ROBOT->position_hold.active){
+        // paused, servo the wheels back to where they stopped
+        update_position_hold(&ROBOT->position_hold, count_right, count_left,
+                right, left);
+        return CONTROL_DRIVE;
+    }
+    
+    if (ROBOT->docking.state >= DOCK_ACTIVE){
+        // marker confirmed, follow the stopping profile in a straight line
+        signed char duty = docking_duty(&ROBOT->docking, count_right,
+                count_left, ROBOT->wheel_speed);
+        
+        if (ROBOT->docking.state != DOCK_ACTIVE){
+            // docked, or given up short of the stop point
+            return CONTROL_BRAKE;
+        }
+        
+        signed char trim = update_heading_hold(&ROBOT->heading, count_right,
+                count_left);
+        *right = duty + trim;
+        *left = duty - trim;
+        return CONTROL_DRIVE;
+    }
+    
+    char meas = mask_failed_sensors(ROBOT->IR_meas_array, ROBOT->IR_failed);
+    short offset = FRAME_COMP ? line_offset_at(&ROBOT->IR_1,
+            ROBOT->latency.sample_count_right,
+            ROBOT->latency.sample_count_left) : line_offset(&ROBOT->IR_1);
+    status = convert_array_to_inputs(&DCRight, &DCLeft, meas);
+    
+    if (status == 0 && ROBOT->latency.enabled){
+        // steer for where the line will be when the wheels answer
+        unsigned short spread = FRAME_COMP ? 0 :
+                ROBOT->scan_period * (IR_SENSORS - 1) / 2;
+        short ahead = predict_line_offset(&ROBOT->latency, offset, ticks,
+                count_right, count_left, spread);
+        
+        meas = offset_pattern(ahead);
+        convert_array_to_inputs(&DCRight, &DCLeft, meas);
+    }
+    
+    if (status == 0){
+        // pattern duties are calibrated at cruise, scale to the plan
+        unsigned short speed = profile_speed(&ROBOT->profile, count_right,
+                count_left);
+        
+        DCRight = profile_duty(DCRight, speed);
+        DCLeft = profile_duty(DCLeft, speed);
+    }
+    
+    if (update_loss_predictor(&ROBOT->loss, &ROBOT->IR_1, offset, elapsed_ms)
+            && status == 0){
+        // line about to slip off the edge, turn back harder and slower
+        avoid_line_loss(&DCRight, &DCLeft);
+    }
+    
+    if (status == 2){
+        // on the marker, keep straight while docking confirms it
+        DCRight = CRUISE_DUTY;
+        DCLeft = CRUISE_DUTY;
+    }
+    
+    if (status == 0 && meas == 2){
+        // line centered, hold the current heading
+        signed char trim = update_heading_hold(&ROBOT->heading, count_right,
+                count_left);
+        DCRight += trim;
+        DCLeft -= trim;
+    }
+    
+    else {
+        reset_heading_hold(&ROBOT->heading, count_right, count_left);
+    }
+    
+    if (status == 0 && ROBOT->IR_failed != 0){
+        // running on the remaining sensors, slow down
+        DCRight = DCRight * DEGRADED_NUM / DEGRADED_DEN;
+        DCLeft = DCLeft * DEGRADED_NUM / DEGRADED_DEN;
+    }
+    
+    if (ROBOT->freq.active){
+        // frequency response test, perturb the steering and correlate
+        signed char steer = status != 1 ? (DCRight - DCLeft) / 2 : 0;
+        signed char perturbation = update_freq_response(&ROBOT->freq,
+                elapsed, steer, offset, status == 0);
+        
+        DCRight += perturbation;
+        DCLeft -= perturbation;
+    }
+    
+    if (status == 0 || status == 2){
+        // normal signal received
+        ROBOT->latency.steer = (DCRight - DCLeft) / 2;
+        *right = DCRight;
+        *left = DCLeft;
+        ROBOT->count_lost = 0;
+        return status == 0 ? CONTROL_FOLLOW : CONTROL_MARKER;
+    }
+    
+    ROBOT->count_lost += elapsed_ms;
+    return CONTROL_LOST;
+}
+
+unsigned short control_period(int speed){
+    /*
+    TMR1 ticks between CONTROL timesteps at speed mm/s. Stopping accuracy
+    needs the fastest control rate at any speed, and the frequency sweep
+    needs at least 10 steps per cycle at its top frequency.
+    */
+    if (ROBOT->docking.state == DOCK_ACTIVE || ROBOT->freq.active){
+        return CONTROL_PERIOD_MIN;
+    }
+    
+    return control_period_for_speed(speed < 0 ? -speed : speed);
+}
+
+static char convert_array_to_inputs(signed char *dcR, signed char *dcL,
+        const char meas){
+    /*
+    Takes the most recent sensor array values and sets the appropriate
+    proportional control duty cycle value for each motor.
+    */
+    
+    char status;
+    // status 0: normal operation
+    //        1: no signal / erroneous signal
+    //        2: stop signal
+    
+    switch(meas){
+        case 0 :        // 000  no signal
+            status = 1;
+            break;
+        case 5 :        // 101  not sure
+            status = 1;
+            break;
+        case 7 :        // 111  stop signal
+            status = 2;
+            break;
+        case 1 :        // 001 line left
+            *dcR = 50;
+            *dcL = 0;
+            status = 0;
+            break;
+        case 3 :        // 011 line slight left
+            *dcR = 35;
+            *dcL = 15;
+            status = 0;
+            break;
+        case 2 :        // 010 line center
+            *dcR = 25;
+            *dcL = 25;
+            status = 0;
+            break;
+        case 6 :        // 110 line slight right
+            *dcR = 15;
+            *dcL = 35;
+            status = 0;
+            break;
+        case 4 :        // 100 line right
+            *dcR = 0;
+            *dcL = 50;
+            status = 0;
+            break;
+        default :       // not a three sensor pattern
+            status = 1;
+            break;
+    }
+    
+    return status;
+}
@@ -0,0 +1,49 @@
+/*
+ * File:   coroutine.c
+ * Author: Jack
+ *
+ * Created on December 31, 2020, 10:00 AM
+ */
+
+#include <coroutine.h>
+#include <clock.h>
+
+void start_coroutine(struct Coroutine *co, 
+        char (*sequence)(struct Coroutine *)){
+    // Replaces whatever sequence was running, from its start
+    co->run = sequence;
+    co->line = 0;
+    co->count = 0;
+}
+
+void stop_coroutine(struct Coroutine *co){
+    co->run = 0;
+    co->line = 0;
+}
+
+char step_coroutine(struct Coroutine *co){
+    /*
+    Runs the sequence up to its next wait. Returns 1 if it ran to the end
+    this step, so a scheduler task spends nothing on the passes it only
+    finds the sequence waiting.
+    */
+    if (co->run == 0){
+        return 0;
+    }
+    
+    if (co->run(co) == CO_WAITING){
+        return 0;
+    }
+    
+    co->run = 0;
+    return 1;
+}
+
+void coroutine_sleep(struct Coroutine *co, unsigned short ms){
+    co->wake_ticks = read_clock_ticks() + (unsigned long)ms * (TMR1_HZ / 1000);
+}
+
+char coroutine_woken(const struct Coroutine *co){
+    // Past wake_ticks, signed so the clock wrapping does not stall it
+    return (long)(read_clock_ticks() - co->wake_ticks) >= 0;
+}
@@ -0,0 +1,34 @@
+/*
+ * File:   crc.c
+ * Author: Jack
+ *
+ * Created on December 13, 2020, 4:30 PM
+ */
+
+#include <crc.h>
+
+#define CRC_POLY 0x07       // CRC-8, x^8 + x^2 + x + 1
+
+unsigned char crc8(const unsigned char *data, unsigned char length){
+    return crc8_continue(0, data, length);
+}
+
+unsigned char crc8_continue(unsigned char crc, const unsigned char *data, 
+        unsigned char length){
+    // Carries crc on over more data, for blocks that are checked as one
+    for (unsigned char i = 0; i < length; ++i){
+        crc ^= data[i];
+        
+        for (unsigned char bit = 0; bit < 8; ++bit){
+            if (crc & 0x80){
+                crc = (crc << 1) ^ CRC_POLY;
+            }
+            
+            else {
+                crc <<= 1;
+            }
+        }
+    }
+    
+    return crc;
+}
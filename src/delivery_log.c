@@ -0,0 +1,280 @@
+/*
+ * File:   delivery_log.c
+ * Author: Jack
+ *
+ * Created on December 13, 2020, 7:40 PM
+ */
+
+#include <xc.h>
+#include <stdio.h>
+#include <pic18f87k22.h>
+#include <delivery_log.h>
+#include <encoders.h>
+#include <clock.h>
+#include <crc.h>
+
+#define BATTERY_DIVIDER 3       // battery divider ratio, 1mV per ADC count
+#define BATTERY_UNIT 50         // mV per battery_min count
+#define SEQUENCE_ERASED 0xFFFF
+#define SEQUENCE_HALF 0x8000    // sequences less than this ahead are newer
+
+struct DeliveryStats
+{
+    char active;
+    char paused;
+    char lost;
+    unsigned short lost_start;
+    unsigned short pause_start;
+    int start_right;
+    int start_left;
+    struct DeliveryRecord record;
+};
+
+// Survives a warm restart, checked by the warm state CRC
+__persistent struct DeliveryStats delivery_stats;
+
+unsigned char log_head = LOG_RECORDS - 1;   // slot of the newest record
+unsigned short log_sequence = 0;            // sequence for the next record
+
+static void read_record(unsigned char, struct DeliveryRecord *);
+static void write_record(unsigned char, struct DeliveryRecord *);
+static unsigned char eeprom_read_byte(unsigned short);
+static void eeprom_write_byte(unsigned short, unsigned char);
+
+void init_delivery_log(char warm){
+    /*
+    Drops any delivery in progress unless resuming after a warm restart,
+    then finds the newest record. Slots are written in order and the sequence
+    number increments by one per record, skipping SEQUENCE_ERASED, so the
+    newest is the valid slot whose successor is erased or not newer. Newer
+    is compared modulo 2^16 so the wrap from 0xFFFE to 0 still counts as
+    continuing. Writing the slots in a circle spreads the wear evenly over
+    the whole EEPROM.
+    */
+    struct DeliveryRecord record;
+    unsigned short sequence[2];
+    
+    if (!warm){
+        delivery_stats.active = 0;
+        delivery_stats.paused = 0;
+    }
+    
+    read_record(0, &record);
+    sequence[0] = record.sequence;
+    
+    for (unsigned char slot = 0; slot < LOG_RECORDS; ++slot){
+        unsigned char next = (slot + 1) % LOG_RECORDS;
+        
+        read_record(next, &record);
+        sequence[1] = record.sequence;
+        
+        unsigned short ahead = (unsigned short)(sequence[1] - sequence[0]);
+        
+        if (sequence[0] != SEQUENCE_ERASED && 
+                (sequence[1] == SEQUENCE_ERASED || ahead == 0 ||
+                ahead >= SEQUENCE_HALF)){
+            log_head = slot;
+            log_sequence = sequence[0] + 1;
+            break;
+        }
+        
+        sequence[0] = sequence[1];
+    }
+    
+    if (log_sequence == SEQUENCE_ERASED){
+        log_sequence = 0;
+    }
+}
+
+void start_delivery_stats(int count_right, int count_left){
+    struct DeliveryRecord *record = &delivery_stats.record;
+    
+    delivery_stats.active = 1;
+    delivery_stats.paused = 0;
+    delivery_stats.lost = 0;
+    delivery_stats.start_right = count_right;
+    delivery_stats.start_left = count_left;
+    
+    record->start_time = clock_seconds();
+    record->lost_events = 0;
+    record->recovery_time = 0;
+    record->pause_time = 0;
+    record->battery_min = 0xFF;
+}
+
+void pause_delivery_stats(){
+    if (delivery_stats.active && !delivery_stats.paused){
+        delivery_stats.paused = 1;
+        delivery_stats.pause_start = clock_deciseconds();
+    }
+}
+
+void resume_delivery_stats(){
+    if (delivery_stats.paused){
+        delivery_stats.paused = 0;
+        delivery_stats.record.pause_time += clock_deciseconds() - 
+                delivery_stats.pause_start;
+    }
+}
+
+void update_delivery_stats(char status){
+    /*
+    Called every CONTROL timestep with the controller status. Each entry
+    into the lost state is an event, and the time until the line is found
+    again counts towards the recovery time.
+    */
+    if (!delivery_stats.active){
+        return;
+    }
+    
+    if (status == 1 && !delivery_stats.lost){
+        if (delivery_stats.record.lost_events < 0xFF){
+            ++delivery_stats.record.lost_events;
+        }
+        
+        delivery_stats.lost = 1;
+        delivery_stats.lost_start = clock_deciseconds();
+    }
+    
+    else if (status != 1 && delivery_stats.lost){
+        delivery_stats.lost = 0;
+        delivery_stats.record.recovery_time += clock_deciseconds() - 
+                delivery_stats.lost_start;
+    }
+}
+
+void update_battery_stats(short reading){
+    unsigned short level = (unsigned short)reading * BATTERY_DIVIDER / 
+            BATTERY_UNIT;
+    
+    if (delivery_stats.active && level < delivery_stats.record.battery_min){
+        delivery_stats.record.battery_min = (unsigned char)level;
+    }
+}
+
+void finish_delivery_stats(char reason, int count_right, int count_left){
+    /*
+    Completes the record and appends it to the log. Blocks for the EEPROM
+    writes, about 4ms per byte, so only call it with the robot stopped.
+    */
+    struct DeliveryRecord *record = &delivery_stats.record;
+    
+    if (!delivery_stats.active){
+        return;
+    }
+    
+    resume_delivery_stats();
+    update_delivery_stats(0);       // closes an open lost interval
+    delivery_stats.active = 0;
+    
+    long counts = ((long)(count_right - delivery_stats.start_right) + 
+                   (count_left - delivery_stats.start_left)) / 2;
+    
+    if (counts < 0){
+        counts = -counts;
+    }
+    
+    record->sequence = log_sequence;
+    record->end_time = clock_seconds();
+    record->distance = (unsigned short)(counts * WHEEL_TRAVEL_MM / 
+            (COUNTS_PER_REV * 10L));
+    record->abort_reason = reason;
+    record->crc = crc8((const unsigned char *)record, LOG_RECORD_SIZE - 1);
+    
+    log_head = (log_head + 1) % LOG_RECORDS;
+    write_record(log_head, record);
+    
+    if (++log_sequence == SEQUENCE_ERASED){
+        log_sequence = 0;
+    }
+}
+
+char delivery_stats_active(){
+    return delivery_stats.active;
+}
+
+unsigned char delivery_stats_crc(unsigned char crc){
+    // crc carried on over the statistics, for the warm state
+    return crc8_continue(crc, (const unsigned char *)&delivery_stats, 
+            sizeof(delivery_stats));
+}
+
+void dump_delivery_log(){
+    /*
+    Prints every record, oldest first, as one line of hex bytes in EEPROM
+    order. tools/decode_log.c turns the dump into a table.
+    */
+    struct DeliveryRecord record;
+    unsigned char slot = log_head;
+    
+    for (unsigned char i = 0; i < LOG_RECORDS; ++i){
+        slot = (slot + 1) % LOG_RECORDS;
+        read_record(slot, &record);
+        
+        if (record.sequence == SEQUENCE_ERASED){
+            continue;
+        }
+        
+        const unsigned char *data = (const unsigned char *)&record;
+        printf("L ");
+        
+        for (unsigned char b = 0; b < LOG_RECORD_SIZE; ++b){
+            printf("%02X", data[b]);
+        }
+        
+        printf("\r\n");
+    }
+    
+    printf("END\r\n");
+}
+
+static void read_record(unsigned char slot, struct DeliveryRecord *record){
+    unsigned char *data = (unsigned char *)record;
+    unsigned short address = (unsigned short)slot * LOG_RECORD_SIZE;
+    
+    for (unsigned char b = 0; b < LOG_RECORD_SIZE; ++b){
+        data[b] = eeprom_read_byte(address + b);
+    }
+}
+
+static void write_record(unsigned char slot, struct DeliveryRecord *record){
+    unsigned char *data = (unsigned char *)record;
+    unsigned short address = (unsigned short)slot * LOG_RECORD_SIZE;
+    
+    for (unsigned char b = 0; b < LOG_RECORD_SIZE; ++b){
+        if (eeprom_read_byte(address + b) != data[b]){
+            // skip bytes that already match, saves time and wear
+            eeprom_write_byte(address + b, data[b]);
+        }
+    }
+}
+
+static unsigned char eeprom_read_byte(unsigned short address){
+    EEADRH = (char)(address >> 8);
+    EEADR = (char)(address & 0x00FF);
+    EECON1bits.EEPGD = 0;       // data EEPROM
+    EECON1bits.CFGS = 0;
+    EECON1bits.RD = 1;
+    
+    return EEDATA;
+}
+
+static void eeprom_write_byte(unsigned short address, unsigned char val){
+    EEADRH = (char)(address >> 8);
+    EEADR = (char)(address & 0x00FF);
+    EEDATA = val;
+    EECON1bits.EEPGD = 0;       // data EEPROM
+    EECON1bits.CFGS = 0;
+    EECON1bits.WREN = 1;
+    
+    // Required unlock sequence, must not be interrupted
+    char gie = INTCONbits.GIEH;
+    INTCONbits.GIEH = 0;
+    EECON2 = 0x55;
+    EECON2 = 0xAA;
+    EECON1bits.WR = 1;
+    INTCONbits.GIEH = gie;
+    
+    while (EECON1bits.WR);
+    EECON1bits.WREN = 0;
+}
@@ -0,0 +1,167 @@
+/*
+ * File:   docking.c
+ * Author: Jack
+ *
+ * Created on December 19, 2020, 4:00 PM
+ */
+
+#include <docking.h>
+#include <encoders.h>
+#include <fixed_math.h>
+#include <trace.h>
+
+#define DOCK_DISTANCE 60        // mm past the leading edge to stop at
+#define DOCK_CONFIRM 8          // mm on the marker before it is believed
+#define DOCK_DECEL 500          // mm/s^2 planned deceleration
+#define DOCK_TOLERANCE 3        // mm from the stop point counted as there,
+                                // two counts at x1 decode and the mm rounding
+#define DOCK_STILL_COUNTS 1     // mean counts of drift while stopped
+#define DOCK_STILL_STEPS 5      // control steps that drift may take, 100ms
+#define DOCK_KV 1               // duty per DOCK_KV_DIV mm/s of speed error
+#define DOCK_KV_DIV 20
+#define DOCK_KI 1               // duty per DOCK_KI_DIV mm of stall each step
+#define DOCK_KI_DIV 4
+#define DOCK_STEPS_MAX 150      // control steps allowed to dock, 3s at 20ms
+
+static int travelled_mm(struct Docking *, int, int);
+static char is_still(struct Docking *, int, int);
+static void set_dock_state(struct Docking *, char);
+
+void reset_docking(struct Docking *dock){
+    set_dock_state(dock, DOCK_IDLE);
+}
+
+void update_dock_marker(struct Docking *dock, char on_marker, int count_right,
+        int count_left){
+    /*
+    Called with every new sensor pattern. The first stop pattern latches the
+    encoder counts as the leading edge, which is then confirmed once the
+    robot has travelled DOCK_CONFIRM with the marker still in view. Losing
+    the marker before that means it was noise, and the search restarts.
+    */
+    if (dock->state == DOCK_IDLE && on_marker){
+        set_dock_state(dock, DOCK_ARMED);
+        dock->marker_right = count_right;
+        dock->marker_left = count_left;
+    }
+    
+    else if (dock->state == DOCK_ARMED){
+        if (travelled_mm(dock, count_right, count_left) >= DOCK_CONFIRM){
+            set_dock_state(dock, DOCK_ACTIVE);
+            dock->still_right = count_right;
+            dock->still_left = count_left;
+            dock->still_steps = 0;
+            dock->steps = 0;
+            dock->push = 0;
+        }
+        
+        else if (!on_marker){
+            set_dock_state(dock, DOCK_IDLE);
+        }
+    }
+}
+
+signed char docking_duty(struct Docking *dock, int count_right, int count_left,
+        int speed){
+    /*
+    Duty cycle for both wheels while docking. The reference speed follows
+    v = sqrt(2 a d) over the distance d left to the stop point, so the robot
+    arrives with zero speed at constant deceleration; an overshoot gives a
+    negative reference and backs up. The duty is a feed forward from the
+    cruise calibration plus a proportional speed correction, and an integral
+    of the distance left while stalled short of the stop point, which grows
+    until the wheels break away. Called once per control step; after
+    DOCK_STEPS_MAX of them the docking has failed, whatever held it up.
+    */
+    int remaining = DOCK_DISTANCE - travelled_mm(dock, count_right, count_left);
+    int abs_remaining = remaining < 0 ? -remaining : remaining;
+    char still = is_still(dock, count_right, count_left);
+    
+    if (abs_remaining <= DOCK_TOLERANCE && still){
+        set_dock_state(dock, DOCK_DONE);
+        return 0;
+    }
+    
+    if (++dock->steps >= DOCK_STEPS_MAX){
+        set_dock_state(dock, DOCK_FAILED);
+        return 0;
+    }
+    
+    if (abs_remaining <= DOCK_TOLERANCE || (long)dock->push * remaining < 0){
+        // there, or overshot, the push would only carry it further
+        dock->push = 0;
+    }
+    
+    if (still && abs_remaining > DOCK_TOLERANCE){
+        dock->push += remaining * DOCK_KI;
+        
+        if (dock->push > CRUISE_DUTY * DOCK_KI_DIV){
+            dock->push = CRUISE_DUTY * DOCK_KI_DIV;
+        }
+        
+        else if (dock->push < -CRUISE_DUTY * DOCK_KI_DIV){
+            dock->push = -CRUISE_DUTY * DOCK_KI_DIV;
+        }
+    }
+    
+    int reference = square_root(2UL * DOCK_DECEL * abs_remaining);
+    
+    if (reference > CRUISE_SPEED){
+        reference = CRUISE_SPEED;
+    }
+    
+    if (remaining < 0){
+        reference = -reference;
+    }
+    
+    int duty = reference * CRUISE_DUTY / CRUISE_SPEED + 
+               (reference - speed) * DOCK_KV / DOCK_KV_DIV + 
+               dock->push / DOCK_KI_DIV;
+    
+    if (duty > CRUISE_DUTY){
+        duty = CRUISE_DUTY;
+    }
+    
+    else if (duty < -CRUISE_DUTY){
+        duty = -CRUISE_DUTY;
+    }
+    
+    return (signed char)duty;
+}
+
+static int travelled_mm(struct Docking *dock, int count_right, int count_left){
+    // Mean of both wheels, differences stay correct across count wrap
+    int counts = ((int)(count_right - dock->marker_right) + 
+                  (int)(count_left - dock->marker_left)) / 2;
+    
+    return (int)((long)counts * WHEEL_TRAVEL_MM / COUNTS_PER_REV);
+}
+
+static char is_still(struct Docking *dock, int count_right, int count_left){
+    /*
+    One count in a 20ms step is already ~14mm/s, so the speed from a single
+    step can't tell crawling from stopped. The robot counts as stopped once
+    the mean count has stayed within DOCK_STILL_COUNTS of where it was for
+    DOCK_STILL_STEPS steps, under 3mm/s. Called once per control step.
+    */
+    int counts = ((int)(count_right - dock->still_right) + 
+                  (int)(count_left - dock->still_left)) / 2;
+    
+    if (counts > DOCK_STILL_COUNTS || counts < -DOCK_STILL_COUNTS){
+        dock->still_right = count_right;
+        dock->still_left = count_left;
+        dock->still_steps = 0;
+        return 0;
+    }
+    
+    if (dock->still_steps < DOCK_STILL_STEPS){
+        ++dock->still_steps;
+    }
+    
+    return dock->still_steps >= DOCK_STILL_STEPS;
+}
+
+static void set_dock_state(struct Docking *dock, char state){
+    dock->state = state;
+    TRACE(TRACE_STATE, TRACE_STATE_DOCK | state);
+}
@@ -9,6 +9,30 @@
 #include <xc.h>
 #include <pic18f87k22.h>
 #include <encoders.h>
+#include <robot.h>
+#include <trace.h>
+
+// Wheel speeds in mm/s at which the resolution steps down, and the lower
+// ones at which it steps back up again
+#define X2_ABOVE 400
+#define X2_BELOW 330
+#define X1_ABOVE 800
+#define X1_BELOW 700
+
+/*
+Count steps indexed by (last << 2) | current, with A in the high bit of each
+pair. The x2 table only counts transitions where A changed and the x1 table
+only where A rose, each scaled so a full quadrature cycle is always 4 counts.
+Interrupt-on-change fires on every edge of both channels whatever the table,
+so the coarser modes only trade resolution, not ISR load, and the encoder
+interrupt rate at top speed is not capped. Cutting it needs channel A moved
+to an INTx or CCP capture pin, which means rewiring the encoders.
+*/
+const signed char encoder_tables[3][16] = {
+    {0, -1, 1, 0, 1, 0, 0, -1, -1, 0, 0, 1, 0, 1, -1, 0},
+    {0, 0, 2, 0, 0, 0, 0, -2, -2, 0, 0, 0, 0, 2, 0, 0},
+    {0, 0, 4, 0, 0, 0, 0, -4, 0, 0, 0, 0, 0, 0, 0, 0}
+};
 
 struct Encoder init_encoder(char pin_A, char pin_B){
     struct Encoder encoder_new = {pin_A, pin_B, 0, 0, 0, 0};
@@ -43,7 +67,51 @@ void start_encoders(){
 }
 
 void stop_encoders(){
-    INTCONbits.RBIE = 0;        // enable Interrupt-on-Change
+    INTCONbits.RBIE = 0;        // disable Interrupt-on-Change
     INTCONbits.RBIF = 0;        // clear flag
 }
 
+
+void set_encoder_mode(char mode){
+    // The ISR reads encoder_steps, swap it while low priority is held off
+    INTCONbits.GIEL = 0;
+    ROBOT->encoder_mode = mode;
+    ROBOT->encoder_steps = encoder_tables[mode];
+    INTCONbits.GIEL = 1;
+    TRACE(TRACE_STATE, TRACE_STATE_ENCODER | mode);
+}
+
+char select_encoder_mode(char mode, int speed){
+    /*
+    Picks the decode resolution for a wheel speed in mm/s, stepping down
+    at high speed and back up at low speed for resolution. The gaps
+    between the thresholds keep it from toggling at a steady speed.
+    */
+    if (speed < 0){
+        speed = -speed;
+    }
+    
+    switch (mode){
+        case ENCODER_X4 :
+            if (speed > X2_ABOVE){
+                mode = ENCODER_X2;
+            }
+            break;
+        case ENCODER_X2 :
+            if (speed > X1_ABOVE){
+                mode = ENCODER_X1;
+            }
+            
+            else if (speed < X2_BELOW){
+                mode = ENCODER_X4;
+            }
+            break;
+        case ENCODER_X1 :
+            if (speed < X1_BELOW){
+                mode = ENCODER_X2;
+            }
+            break;
+    }
+    
+    return mode;
+}
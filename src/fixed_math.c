@@ -0,0 +1,55 @@
+/*
+ * File:   fixed_math.c
+ * Author: Jack
+ *
+ * Created on December 19, 2020, 3:15 PM
+ */
+
+#include <fixed_math.h>
+
+// sin over the first quarter cycle in 64 steps, scaled to 127
+static const signed char quarter_sine[65] = {
+      0,   3,   6,   9,  12,  16,  19,  22,  25,  28,  31,  34,  37,
+     40,  43,  46,  49,  51,  54,  57,  60,  63,  65,  68,  71,  73,
+     76,  78,  81,  83,  85,  88,  90,  92,  94,  96,  98, 100, 102,
+    104, 106, 107, 109, 111, 112, 113, 115, 116, 117, 118, 120, 121,
+    122, 122, 123, 124, 125, 125, 126, 126, 126, 127, 127, 127, 127
+};
+
+unsigned short square_root(unsigned long val){
+    // Bitwise integer square root, rounds down
+    unsigned long root = 0;
+    unsigned long bit = 1UL << 30;
+    
+    while (bit > val){
+        bit >>= 2;
+    }
+    
+    while (bit != 0){
+        if (val >= root + bit){
+            val -= root + bit;
+            root = (root >> 1) + bit;
+        }
+        
+        else {
+            root >>= 1;
+        }
+        
+        bit >>= 2;
+    }
+    
+    return (unsigned short)root;
+}
+
+signed char sine(unsigned char angle){
+    // 127 sin of angle, 256 steps per cycle, from the quarter wave table
+    unsigned char step = angle & 0x3F;
+    signed char value;
+    
+    if (angle & 0x40){
+        step = 64 - step;
+    }
+    
+    value = quarter_sine[step];
+    return angle & 0x80 ? -value : value;
+}
@@ -0,0 +1,102 @@
+/*
+ * File:   freq_response.c
+ * Author: Jack
+ *
+ * Created on December 29, 2020, 11:00 AM
+ */
+
+#include <string.h>
+#include <freq_response.h>
+#include <fixed_math.h>
+#include <sample_rates.h>
+
+#define ANGLE_STEP (FREQ_CYCLE / 256)   // phase per step of sine()
+#define ELAPSED_MAX (4UL * CONTROL_PERIOD_MAX)  // longer gaps are a stall
+
+// 0.2 Hz to 5 Hz, the control timestep is pinned at 50 Hz during the test
+const unsigned short freq_centihz[FREQ_POINTS] = {
+    20, 30, 50, 70, 100, 150, 200, 300, 400, 500
+};
+
+static void clear_sums(struct FreqResponse *);
+
+void start_freq_response(struct FreqResponse *freq){
+    freq->active = 1;
+    freq->ready = 0;
+    freq->point = 0;
+    freq->cycles = 0;
+    freq->phase = 0;
+    clear_sums(freq);
+}
+
+void stop_freq_response(struct FreqResponse *freq){
+    freq->active = 0;
+}
+
+signed char update_freq_response(struct FreqResponse *freq, 
+        unsigned long elapsed, signed char steer, short offset, char valid){
+    /*
+    Called every CONTROL timestep while the test runs, elapsed TMR1 ticks
+    after the last one, with the controller's steering (right duty less
+    left, halved) and the line offset. Returns the perturbation to add to
+    the right duty and take off the left. Only steps with valid set, the
+    line found by the pattern, go into the sums. The timestep is not
+    regular, so the phase follows the clock rather than a step count. A
+    stalled step is clamped so it can't overflow the phase or skip cycles.
+    */
+    if (!freq->active){
+        return 0;
+    }
+    
+    if (elapsed > ELAPSED_MAX){
+        elapsed = ELAPSED_MAX;
+    }
+    
+    freq->phase += freq_centihz[(int)freq->point] * elapsed;
+    
+    while (freq->phase >= FREQ_CYCLE){
+        freq->phase -= FREQ_CYCLE;
+        ++freq->cycles;
+        
+        if (freq->cycles == FREQ_SETTLE_CYCLES){
+            clear_sums(freq);
+        }
+        
+        else if (freq->cycles == FREQ_SETTLE_CYCLES + FREQ_MEASURE_CYCLES){
+            freq->result = freq->sums;
+            freq->ready = 1;
+            freq->cycles = 0;
+            
+            if (++freq->point == FREQ_POINTS){
+                freq->active = 0;
+                return 0;
+            }
+            
+            clear_sums(freq);
+        }
+    }
+    
+    unsigned char angle = (unsigned char)(freq->phase / ANGLE_STEP);
+    signed char s = sine(angle);
+    signed char c = sine(angle + 64);
+    signed char perturbation = FREQ_AMPLITUDE * s / 127;
+    
+    if (valid && freq->cycles >= FREQ_SETTLE_CYCLES){
+        int applied = steer + perturbation;
+        
+        freq->sums.u_sin += (long)applied * s;
+        freq->sums.u_cos += (long)applied * c;
+        freq->sums.c_sin += (long)steer * s;
+        freq->sums.c_cos += (long)steer * c;
+        freq->sums.y_sin += (long)offset * s;
+        freq->sums.y_cos += (long)offset * c;
+        ++freq->sums.samples;
+    }
+    
+    return perturbation;
+}
+
+static void clear_sums(struct FreqResponse *freq){
+    memset(&freq->sums, 0, sizeof(freq->sums));
+    freq->sums.centihz = freq_centihz[(int)freq->point];
+}
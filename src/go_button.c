@@ -9,14 +9,13 @@
 #include <pic18f87k22.h>
 #include <go_button.h>
 #include <encoders.h>
+#include <robot.h>
 
 #define _XTAL_FREQ 16000000
 
 #define GO_T TRISB0
 #define GO_P PORTB0
 
-extern char display_value;
-
 void init_go_button(){
     TRISBbits.GO_T = 1;
     INTCON2bits.INTEDG0 = 1;
@@ -42,20 +41,29 @@ void disable_go_button(){
     INTCONbits.INT0IF = 0;  // Clear flag
 }
 
-void execute_delivery(){
-	motors_drive(0, 0);
-	motors_engage();
-    // could add a light thing here
+char execute_delivery(struct Coroutine *co){
+    // Start light sequence, then sensing and control
     static char x[] = {0x00, 0x01, 0x02, 0x04, 0x08, 0x10, 0x20, 0x40, 0x80, 
                        0x00};
     
-    for (int i = 9; i >= 0; --i){
-            load_byte(x[i]);
-            __delay_ms(100);
+    CO_BEGIN(co);
+    
+    for (co->count = 10; co->count > 0; --co->count){
+        load_byte(x[co->count - 1]);
+        CO_SLEEP_MS(co, 100);
     }
     
+    resume_delivery();
+    CO_END(co);
+}
+
+void resume_delivery(){
+    // Starts sensing and control without the light sequence
+	motors_drive(0, 0);
+	motors_engage();
     start_ADC();
     start_encoders();
+    ROBOT->control_restart = 1;     // the last CONTROL timestep is stale
     PIR4bits.CCP3IF = 0;            // clear
     PIE4bits.CCP3IE = 1;            // enable
 
@@ -65,37 +73,30 @@ void enter_sleep_mode(){
 	motors_disengage();
 	stop_ADC();
 	// could add a light thing here
-	display_value = 0;
+	ROBOT->display_value = 0;
     __delay_ms(100);
 	Sleep();
 }
 
 void pause_delivery(){
+    // Stops the robot at once, pause_sequence shows it on the display
     motors_brake();
     PIE4bits.CCP3IE = 0;            // disable 
     PIR4bits.CCP3IF = 0;            // clear
     stop_ADC();
-    
+}
+
+char pause_sequence(struct Coroutine *co){
     static char x[] = {0x00, 0x01, 0x02, 0x04, 0x08, 0x10, 0x20, 0x40, 0x80, 
                        0x00};
     
-    for (int i = 0; i <= 10; ++i){
-            load_byte(x[i]);
-            __delay_ms(100);
-    }
-}
-
-char go_button_handler(char val){
-    if (val == 1){
-        // robot was running
-        val = 0;
-    }
-
-    else if (val == 0){
-        // robot was stopped
-        val = 1;
+    CO_BEGIN(co);
+    
+    for (co->count = 0; co->count < 10; ++co->count){
+        load_byte(x[co->count]);
+        CO_SLEEP_MS(co, 100);
     }
     
-    return val;
+    CO_END(co);
 }
 
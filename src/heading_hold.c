@@ -0,0 +1,72 @@
+/*
+ * File:   heading_hold.c
+ * Author: Jack
+ *
+ * Created on December 6, 2020, 9:10 AM
+ */
+
+#include <heading_hold.h>
+
+#define HOLD_KP 2           // trim per count of differential this update
+#define HOLD_KI 1           // trim per count of accumulated differential
+#define HOLD_DIV 4          // common divisor for both gains
+#define HOLD_TRIM_MAX 8     // largest correction applied to each wheel
+#define HOLD_ERROR_MAX 64   // anti-windup limit on heading_error
+
+void init_heading_hold(struct HeadingHold *hold, char enabled){
+    hold->enabled = enabled;
+    reset_heading_hold(hold, 0, 0);
+}
+
+void reset_heading_hold(struct HeadingHold *hold, int count_right, int count_left){
+    /*
+    Starts a new straight segment. The current encoder counts become the
+    reference and any accumulated trim is dropped.
+    */
+    hold->count_right_last = count_right;
+    hold->count_left_last = count_left;
+    hold->heading_error = 0;
+    hold->trim = 0;
+}
+
+signed char update_heading_hold(struct HeadingHold *hold, int count_right, int count_left){
+    /*
+    Compares the distance each wheel travelled since the last update. A
+    positive differential means the right wheel is running ahead and the
+    robot is yawing left, so the returned trim is negative: it is subtracted
+    from the right duty cycle and added to the left one.
+    */
+    int diff = (count_right - hold->count_right_last) - 
+               (count_left - hold->count_left_last);
+    
+    hold->count_right_last = count_right;
+    hold->count_left_last = count_left;
+    
+    if (!hold->enabled){
+        hold->trim = 0;
+        return 0;
+    }
+    
+    hold->heading_error += diff;
+    
+    if (hold->heading_error > HOLD_ERROR_MAX){
+        hold->heading_error = HOLD_ERROR_MAX;
+    }
+    
+    else if (hold->heading_error < -HOLD_ERROR_MAX){
+        hold->heading_error = -HOLD_ERROR_MAX;
+    }
+    
+    int trim = -(HOLD_KP * diff + HOLD_KI * hold->heading_error) / HOLD_DIV;
+    
+    if (trim > HOLD_TRIM_MAX){
+        trim = HOLD_TRIM_MAX;
+    }
+    
+    else if (trim < -HOLD_TRIM_MAX){
+        trim = -HOLD_TRIM_MAX;
+    }
+    
+    hold->trim = (signed char)trim;
+    return hold->trim;
+}
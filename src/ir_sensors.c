@@ -7,11 +7,35 @@
 
 #include <xc.h>
 #include <ir_sensors.h>
+#include <clock.h>
+#include <fixed_math.h>
+
+#define CHARACTERIZE_SAMPLES 64     // conversions per sensor and profile
+
+#define SCAN_AGE_MAX 4      // samples another sensor may take before a
+                            // far sensor is forced back into the scan
+
+/*
+ADCON2 values, right justified. Tad is always at least the 1us minimum of the
+12-bit converter (Fosc/16 at 16MHz), the profiles trade acquisition time for
+settling of the sensor's source impedance:
+    FAST     Tacq = 2Tad,  Tad = 16Tosc
+    BALANCED Tacq = 4Tad,  Tad = 16Tosc
+    PRECISE  Tacq = 12Tad, Tad = 16Tosc
+The previous hard-coded 0b10101001 was Tacq = 12Tad with Tad = 8Tosc, which
+is below the minimum Tad, so PRECISE keeps its acquisition time in spec.
+*/
+static const char adc_profiles[ADC_PROFILES] = {
+    0b10001101,
+    0b10010101,
+    0b10101101
+};
+
+static char sensor_near_line(struct IRSensor *, char);
 
 void init_ADC(struct IRSensor *sensor){
     ADCON1 = 0b00110000;    //Configure ADCON1 for AVdd(GND) and AVss(4.096V)
-    ADCON2 = 0b10101001;    //Configure ADCON2 for right justified; Tacq = 4Tad 
-                            //and Tad = 16Tosc
+    set_ADC_profile(ADC_PROFILE_PRECISE);
 
     ANCON0bits.ANSEL2 = 1;  //Configure AN0 as analog input
     TRISAbits.TRISA2 = 1;
@@ -23,6 +47,16 @@ void init_ADC(struct IRSensor *sensor){
     stop_ADC();
 }
 
+void init_battery_ADC(){
+    // Battery divider on AN5, call after init_motors() claims PORTF
+    ANCON0bits.ANSEL5 = 1;
+    TRISFbits.TRISF7 = 1;
+}
+
+void set_ADC_profile(char profile){
+    ADCON2 = adc_profiles[profile];
+}
+
 void start_ADC(){
     ADCON0bits.ADON = 1;
     ADCON0bits.GO = 1;
@@ -54,3 +88,151 @@ char convert_measurement_to_binary(short val, short max){
     
     return result;
 }
+
+
+struct IRSensor *scan_next_sensor(struct IRSensor *current, char meas){
+    /*
+    Picks the sensor to sample after current. Sensors on or next to a set
+    bit of meas are near the line and are visited in ring order; the others
+    are only sampled once their age reaches SCAN_AGE_MAX, which bounds how
+    stale any bit of the pattern can get. With no line in view every sensor
+    counts as near, which is the plain round-robin scan. current may also
+    be a sensor outside the ring whose next_sensor points into it.
+    */
+    struct IRSensor *sensor = current->next_sensor;
+    struct IRSensor *choice = 0;
+    struct IRSensor *oldest = sensor;
+    
+    do {
+        if (sensor->age > oldest->age){
+            oldest = sensor;
+        }
+        
+        if (choice == 0 && sensor_near_line(sensor, meas)){
+            choice = sensor;
+        }
+        
+        sensor = sensor->next_sensor;
+    } while (sensor != current->next_sensor);
+    
+    if (oldest->age >= SCAN_AGE_MAX || choice == 0){
+        choice = oldest;
+    }
+    
+    // Age every sensor except the one chosen
+    choice->age = 0;
+    sensor = choice->next_sensor;
+    
+    while (sensor != choice){
+        if (sensor->age < SCAN_AGE_MAX){
+            ++sensor->age;
+        }
+        
+        sensor = sensor->next_sensor;
+    }
+    
+    return choice;
+}
+
+void update_scan_rates(struct IRSensor *first, unsigned long window){
+    /*
+    Converts the samples counted over the last window of TMR1 ticks into an
+    effective per-sensor sample rate and starts a new window.
+    */
+    struct IRSensor *sensor = first;
+    
+    do {
+        sensor->rate = (unsigned short)(sensor->samples * TMR1_HZ / window);
+        sensor->samples = 0;
+        sensor = sensor->next_sensor;
+    } while (sensor != first);
+}
+
+static char sensor_near_line(struct IRSensor *sensor, char meas){
+    if (meas == 0){
+        // line lost, every sensor is equally important
+        return 1;
+    }
+    
+    char window = 0b111 << sensor->index;   // neighbours and itself, at +1
+    
+    return ((meas << 1) & window) != 0;
+}
+
+char characterize_ADC(struct IRSensor *first, struct ADCProfileStats *stats, 
+        short noise_limit){
+    /*
+    Runs every profile over the sensors in the ring starting at first, which
+    must be held over a static surface. For each profile the conversion
+    throughput and the per-sensor standard deviation are written to stats.
+    The ADC must be stopped; conversions are polled. Returns the fastest
+    profile whose noise on every sensor is at most noise_limit (0.1 counts),
+    or ADC_PROFILE_PRECISE if none is, and leaves that profile applied.
+    */
+    char chosen = ADC_PROFILE_PRECISE;
+    signed char profile;
+    
+    for (profile = ADC_PROFILES - 1; profile >= 0; --profile){
+        struct IRSensor *sensor = first;
+        unsigned short ticks = 0;
+        char noisy = 0;
+        
+        set_ADC_profile(profile);
+        
+        for (char i = 0; i < CHARACTERIZE_SENSORS; ++i){
+            ADCON0 = sensor->adcon0_value;
+            ADCON0bits.GO = 1;          // settling conversion, discarded
+            while (ADCON0bits.GO);
+            
+            short first_val = (ADRESH << 8) | ADRESL;
+            long sum = 0;
+            unsigned long sum_sq = 0;
+            unsigned short start = read_TMR1();
+            
+            for (char n = 0; n < CHARACTERIZE_SAMPLES; ++n){
+                ADCON0bits.GO = 1;
+                while (ADCON0bits.GO);
+                
+                // deviations from the first value keep the sums small
+                short dev = ((ADRESH << 8) | ADRESL) - first_val;
+                sum += dev;
+                sum_sq += (long)dev * dev;
+            }
+            
+            ticks += read_TMR1() - start;
+            
+            // variance in 0.01 counts^2, scaled only while it cannot overflow
+            unsigned long var;
+            long mean;
+            
+            if (sum_sq < 40000000UL){
+                mean = sum * 10 / CHARACTERIZE_SAMPLES;
+                var = sum_sq * 100 / CHARACTERIZE_SAMPLES - mean * mean;
+            }
+            
+            else {
+                mean = sum / CHARACTERIZE_SAMPLES;
+                var = (sum_sq / CHARACTERIZE_SAMPLES - mean * mean) * 100;
+            }
+            
+            stats[profile].noise[i] = square_root(var);
+            
+            if (stats[profile].noise[i] > noise_limit){
+                noisy = 1;
+            }
+            
+            sensor = sensor->next_sensor;
+        }
+        
+        stats[profile].conversions_per_second = (unsigned short)(TMR1_HZ * 
+                (CHARACTERIZE_SAMPLES * CHARACTERIZE_SENSORS) / ticks);
+        
+        if (!noisy){
+            chosen = profile;
+        }
+    }
+    
+    PIR1bits.ADIF = 0;
+    set_ADC_profile(chosen);
+    return chosen;
+}
@@ -0,0 +1,108 @@
+/*
+ * File:   latency_comp.c
+ * Author: Jack
+ *
+ * Created on December 30, 2020, 2:00 PM
+ */
+
+#include <latency_comp.h>
+#include <line_offset.h>
+#include <encoders.h>
+#include <docking.h>
+#include <clock.h>
+
+#define PATTERN_SLIGHT (LINE_OFFSET_SCALE / 4)      // 010 to 011 or 110
+#define PATTERN_OUTER (LINE_OFFSET_SCALE * 3 / 4)   // 011 to 001, 110 to 100
+
+void init_latency_comp(struct LatencyComp *comp, char enabled){
+    comp->enabled = enabled;
+    comp->sample_ticks = 0;
+    comp->sample_count_right = 0;
+    comp->sample_count_left = 0;
+    comp->steer = 0;
+    comp->latency_ms = 0;
+    comp->predicted = 0;
+}
+
+void mark_latency_sample(struct LatencyComp *comp, unsigned long ticks, 
+        int count_right, int count_left){
+    // Called with every processed IR sample, the start of the pipeline
+    comp->sample_ticks = ticks;
+    comp->sample_count_right = count_right;
+    comp->sample_count_left = count_left;
+}
+
+short predict_line_offset(struct LatencyComp *comp, short offset, 
+        unsigned long ticks, int count_right, int count_left, 
+        unsigned short spread){
+    /*
+    Line offset expected once a duty set now reaches the wheels. The delay
+    is measured each time: the age of the newest sample, plus spread ticks
+    for the mean age of the others when the frame was not reprojected, plus
+    the motor lag. The wheel travel over it comes in two parts:
+    - sample to now, from the encoder counts since the sample
+    - now to the wheels answering, from the wheel speeds since the sample
+      easing toward the steering being applied
+    and array_shift() turns that into how far the line moves across the
+    array. Only the turn is modelled; the heading already held against the
+    line shows in the measurement, as in any Smith predictor.
+    */
+    if (!comp->enabled){
+        return offset;
+    }
+    
+    unsigned long since = ticks - comp->sample_ticks + spread;
+    long sense_ms = (long)(since * 1000 / TMR1_HZ);
+    
+    comp->latency_ms = (unsigned short)(sense_ms + LATENCY_MOTOR_LAG_MS);
+    
+    if (sense_ms == 0){
+        sense_ms = 1;
+    }
+    
+    // wheel speeds in counts/s, now and once the steering takes hold
+    long right = count_right - comp->sample_count_right;
+    long left = count_left - comp->sample_count_left;
+    long right_now = right * 1000 / sense_ms;
+    long left_now = left * 1000 / sense_ms;
+    long forward = (right_now + left_now) / 2;
+    long steer = (long)comp->steer * CRUISE_SPEED * COUNTS_PER_REV / 
+            ((long)CRUISE_DUTY * WHEEL_TRAVEL_MM);
+    
+    right += (right_now + forward + steer) / 2 * LATENCY_MOTOR_LAG_MS / 1000;
+    left += (left_now + forward - steer) / 2 * LATENCY_MOTOR_LAG_MS / 1000;
+    
+    long predicted = offset - array_shift((int)right, (int)left);
+    
+    if (predicted > LINE_OFFSET_SCALE){
+        predicted = LINE_OFFSET_SCALE;
+    }
+    
+    if (predicted < -LINE_OFFSET_SCALE){
+        predicted = -LINE_OFFSET_SCALE;
+    }
+    
+    comp->predicted = (short)predicted;
+    return comp->predicted;
+}
+
+char offset_pattern(short offset){
+    // Sensor pattern the pattern controller would see at this offset
+    if (offset >= PATTERN_OUTER){
+        return 0b001;
+    }
+    
+    if (offset >= PATTERN_SLIGHT){
+        return 0b011;
+    }
+    
+    if (offset > -PATTERN_SLIGHT){
+        return 0b010;
+    }
+    
+    if (offset > -PATTERN_OUTER){
+        return 0b110;
+    }
+    
+    return 0b100;
+}
@@ -0,0 +1,163 @@
+/*
+ * File:   line_loss.c
+ * Author: Jack
+ *
+ * Created on December 30, 2020, 10:00 AM
+ */
+
+#include <line_loss.h>
+#include <line_offset.h>
+#include <trace.h>
+
+#define LOSS_OFFSET LINE_OFFSET_SCALE       // only the outer sensor left
+#define LOSS_CLEAR (LINE_OFFSET_SCALE / 2)  // back inside this, forecast off
+#define RATE_WEIGHT 3           // old rate weight in the running average, /4
+#define AVOID_SPEED_NUM 3       // forward duty kept while avoiding
+#define AVOID_SPEED_DEN 4
+#define AVOID_STEER_NUM 3       // steering duty scale while avoiding
+#define AVOID_STEER_DEN 2
+#define NO_FORECAST 0xFFFF
+
+static short outer_reading(const struct IRSensor *, signed char);
+static int average_rate(int, long, unsigned short);
+static unsigned short time_to(long, int);
+
+void init_loss_predictor(struct LossPredictor *predictor, char enabled, 
+        unsigned short horizon_ms, short cutoff){
+    predictor->enabled = enabled;
+    predictor->imminent = 0;
+    predictor->horizon_ms = horizon_ms;
+    predictor->cutoff = cutoff;
+    predictor->offset_last = 0;
+    predictor->outer_last = 0;
+    predictor->side = 1;
+    predictor->offset_rate = 0;
+    predictor->fade_rate = 0;
+    predictor->forecast_ms = NO_FORECAST;
+}
+
+char update_loss_predictor(struct LossPredictor *predictor, 
+        const struct IRSensor *ring, short offset, unsigned short elapsed_ms){
+    /*
+    Called every CONTROL timestep with the line offset, elapsed_ms after the
+    last. Two forecasts are made and the sooner counts:
+    - the offset moving outward reaches LOSS_OFFSET, where only the
+      outermost sensor still sees the line
+    - that sensor's reading, falling, reaches the cutoff, the moment the
+      pattern would go to 000
+    Both rates are running averages, a single noisy reading cannot trip
+    the forecast. Returns 1 while a loss is imminent.
+    */
+    signed char side = offset >= 0 ? 1 : -1;
+    short outward = offset >= 0 ? offset : -offset;
+    short outer = outer_reading(ring, side);
+    
+    if (!predictor->enabled || elapsed_ms == 0){
+        return 0;
+    }
+    
+    if (side != predictor->side){
+        // crossed the center, the outer sensor is now the other one
+        predictor->side = side;
+        predictor->outer_last = outer;
+        predictor->fade_rate = 0;
+    }
+    
+    predictor->offset_rate = average_rate(predictor->offset_rate, 
+            (long)(offset - predictor->offset_last) * side, elapsed_ms);
+    predictor->fade_rate = average_rate(predictor->fade_rate, 
+            (long)predictor->outer_last - outer, elapsed_ms);
+    predictor->offset_last = offset;
+    predictor->outer_last = outer;
+    
+    unsigned short forecast = NO_FORECAST;
+    
+    if (outward < LOSS_OFFSET){
+        forecast = time_to(LOSS_OFFSET - outward, predictor->offset_rate);
+    }
+    
+    else if (outer < 0){
+        // outer sensor failed, nothing to watch fade
+        forecast = NO_FORECAST;
+    }
+    
+    else if (outer > predictor->cutoff){
+        forecast = time_to(outer - predictor->cutoff, predictor->fade_rate);
+    }
+    
+    else {
+        forecast = 0;
+    }
+    
+    predictor->forecast_ms = forecast;
+    
+    if (!predictor->imminent && forecast <= predictor->horizon_ms){
+        predictor->imminent = 1;
+        TRACE(TRACE_STATE, TRACE_STATE_LOSS | 1);
+    }
+    
+    else if (predictor->imminent && outward < LOSS_CLEAR){
+        predictor->imminent = 0;
+        TRACE(TRACE_STATE, TRACE_STATE_LOSS | 0);
+    }
+    
+    return predictor->imminent;
+}
+
+void avoid_line_loss(signed char *right, signed char *left){
+    /*
+    Cuts the forward part of the pattern duties and scales up the steering
+    part, so the robot turns back toward the line on a tighter radius with
+    less travel to overshoot in.
+    */
+    int forward = (*right + *left) / 2 * AVOID_SPEED_NUM / AVOID_SPEED_DEN;
+    int steer = (*right - *left) / 2 * AVOID_STEER_NUM / AVOID_STEER_DEN;
+    
+    *right = (signed char)(forward + steer);
+    *left = (signed char)(forward - steer);
+}
+
+static short outer_reading(const struct IRSensor *ring, 
+        signed char side){
+    // Reading of the sensor at the end of the array on the given side, -1
+    // when it has failed
+    const struct IRSensor *sensor = ring;
+    
+    for (char i = 0; i < IR_SENSORS; ++i){
+        if (sensor->position == side){
+            return sensor->failed ? -1 : sensor->reading;
+        }
+        
+        sensor = sensor->next_sensor;
+    }
+    
+    return -1;
+}
+
+static int average_rate(int average, long change, unsigned short elapsed_ms){
+    // Running average of change per second, limited to the int range
+    long rate = change * 1000 / elapsed_ms;
+    
+    rate = (average * (long)RATE_WEIGHT + rate) / (RATE_WEIGHT + 1);
+    
+    if (rate > 32767){
+        rate = 32767;
+    }
+    
+    if (rate < -32767){
+        rate = -32767;
+    }
+    
+    return (int)rate;
+}
+
+static unsigned short time_to(long distance, int rate){
+    // ms to cover distance at rate per second, NO_FORECAST when not closing
+    if (rate <= 0){
+        return NO_FORECAST;
+    }
+    
+    long ms = distance * 1000 / rate;
+    
+    return ms < NO_FORECAST ? (unsigned short)ms : NO_FORECAST;
+}
@@ -0,0 +1,109 @@
+/*
+ * File:   line_offset.c
+ * Author: Jack
+ *
+ * Created on December 29, 2020, 9:30 AM
+ */
+
+#include <line_offset.h>
+#include <encoders.h>
+
+#define SHIFT_COUNTS_MAX 1440   // wheel travel array_shift() works to, 400 mm
+#define STAMP_COUNTS_MAX 360    // a reading older than this is not moved
+
+static int limit_counts(int, int);
+static short centroid(const struct IRSensor *, char, int, int);
+
+short line_offset(const struct IRSensor *ring){
+    /*
+    Line position across the array from the last readings of the sensor
+    ring, in 1/LINE_OFFSET_SCALE of the sensor spacing and positive to the
+    left. Each sensor is weighted by how far its reading rises above the
+    lowest one, so the floor level cancels out; with every sensor reading
+    alike the offset is 0. Failed sensors are left out.
+    */
+    return centroid(ring, 0, 0, 0);
+}
+
+short line_offset_at(const struct IRSensor *ring, int count_right, 
+        int count_left){
+    /*
+    As line_offset(), with each reading placed where its patch of floor
+    sits in the robot's frame at the moment of the given encoder counts.
+    Since a reading was taken the robot has turned, so that patch has
+    moved sideways across the array by array_shift() of the wheel travel
+    in between.
+    */
+    return centroid(ring, 1, count_right, count_left);
+}
+
+short array_shift(int right_counts, int left_counts){
+    /*
+    Sideways travel of the sensor array in offset counts, positive to the
+    left, for the wheels turning right_counts and left_counts. A turn of
+    d_theta swings the array by the lever to it plus half the distance
+    travelled, times d_theta. Worked in 1/16 mm so that the few mm a
+    turn moves the array between samples keep their resolution. Travel
+    is limited to SHIFT_COUNTS_MAX so the products stay in long.
+    */
+    long right = (long)limit_counts(right_counts, SHIFT_COUNTS_MAX) * 
+            WHEEL_TRAVEL_MM * 16 / COUNTS_PER_REV;
+    long left = (long)limit_counts(left_counts, SHIFT_COUNTS_MAX) * 
+            WHEEL_TRAVEL_MM * 16 / COUNTS_PER_REV;
+    long forward = (right + left) / 2;
+    long shift = (right - left) * (SENSOR_AHEAD_MM * 16 + forward / 2) / 
+            (WHEEL_BASE_MM * 16);
+    
+    return (short)(shift * LINE_OFFSET_SCALE / (SENSOR_SPACING_MM * 16));
+}
+
+static short centroid(const struct IRSensor *ring, char reproject, 
+        int count_right, int count_left){
+    // Weighted mean sensor position, moved to the given counts if reproject
+    const struct IRSensor *sensor = ring;
+    short floor = 0x7FFF;
+    long sum = 0;
+    long moment = 0;
+    
+    for (char i = 0; i < IR_SENSORS; ++i){
+        if (!sensor->failed && sensor->reading < floor){
+            floor = sensor->reading;
+        }
+        
+        sensor = sensor->next_sensor;
+    }
+    
+    for (char i = 0; i < IR_SENSORS; ++i){
+        if (!sensor->failed){
+            short weight = sensor->reading - floor;
+            long position = (long)sensor->position * LINE_OFFSET_SCALE;
+            int right = count_right - sensor->sample_count_right;
+            int left = count_left - sensor->sample_count_left;
+            
+            // A stale stamp, as after a warm restart restores the counts,
+            // is left where it is
+            if (reproject && limit_counts(right, STAMP_COUNTS_MAX) == right 
+                    && limit_counts(left, STAMP_COUNTS_MAX) == left){
+                position -= array_shift(right, left);
+            }
+            
+            sum += weight;
+            moment += weight * position;
+        }
+        
+        sensor = sensor->next_sensor;
+    }
+    
+    if (sum == 0){
+        return 0;
+    }
+    
+    long offset = moment / sum;
+    
+    return (short)(offset > LINE_OFFSET_SCALE ? LINE_OFFSET_SCALE : 
+            offset < -LINE_OFFSET_SCALE ? -LINE_OFFSET_SCALE : offset);
+}
+
+static int limit_counts(int counts, int limit){
+    return counts > limit ? limit : counts < -limit ? -limit : counts;
+}
@@ -7,15 +7,24 @@
  * This program drives a differential drive line-following between two
  * predetermined locations on a PIC18F87K22. Resources currently assigned are:
  * 
- * TMR1 - main.c, PS 8
+ * TMR1 - main.c, PS 8, overflow counts uptime in clock.h
  * TMR2 - motors.c, PS 4
  *
- * CCP2 - TMR1, observer - measurement update timestep
- * CCP3 - TMR1, control - output update timestep
+ * CCP2 - TMR1, observer - ADC conversion timestep, scaled with speed
+ * CCP3 - TMR1, control - output update timestep, scaled with speed
  * CCP4 - TMR2, motors.h - PWM
  * CCP5 - TMR2, motors.h - PWM
  * CCP6 - TMR1, shift_register.h - display update
  * CCP7 - TMR1, go_button.h - debounce
+ *
+ * EUSART1 - uart.h, 'D' dumps the delivery log, 'T' the event trace,
+ *           'S' starts and stops the telemetry stream
+ * EEPROM - delivery_log.h, per-delivery statistics
+ *
+ * RD0 - with ISR_PROBE 1, high for the whole of LoPriISR for a scope
+ *
+ * WDT - 4s, cleared by the main loop. A watchdog reset resumes the delivery
+ * recorded in warm_restart.h instead of starting over.
  */
 
 #include <xc.h>
@@ -28,10 +37,30 @@
 #include <ir_sensors.h>
 #include <motors.h>
 #include <encoders.h>
+#include <heading_hold.h>
+#include <position_hold.h>
+#include <uart.h>
+#include <warm_restart.h>
+#include <clock.h>
+#include <delivery_log.h>
+#include <sample_rates.h>
+#include <scheduler.h>
+#include <docking.h>
+#include <trace.h>
+#include <telemetry_codec.h>
+#include <robot.h>
+#include <speed_profile.h>
+#include <line_offset.h>
+#include <freq_response.h>
+#include <line_loss.h>
+#include <latency_comp.h>
+#include <coroutine.h>
+#include <sensor_health.h>
+#include <control.h>
 
 #define _XTAL_FREQ 16000000
 #pragma config FOSC=HS1, PWRTEN=ON, BOREN=ON, BORV=2, PLLCFG=OFF
-#pragma config WDTEN=OFF, CCP2MX=PORTC, XINST=OFF
+#pragma config WDTEN=NOSLP, WDTPS=1024, CCP2MX=PORTC, XINST=OFF
 
 // ADCON2 Values
 #define IR0 0b00000001      // AN0 on
@@ -43,11 +72,12 @@
 // Constants
 #define READINGS_MAX 2      // Readings each analog sensor takes
 #define SENSORS_MAX 4       
-#define ADC_CUTOFF 3500
-#define OBSERVE 5000        // ps8 instructions for 10ms
-#define CONTROL 50000       // ps8 instructions for 100ms
 #define DISPLAY 25000       // ps8 instructions for 50ms
 #define DEBOUNCE 10000      // ps8 instructions for 20ms
+#define ADC_NOISE_LIMIT 20  // 0.1 counts, worst sensor noise accepted
+#define SCAN_RATE_OVERFLOWS 8       // TMR1 overflows per rate window, ~1s
+#define LOST_TIMEOUT 1000   // ms with a lost reading before aborting
+#define WARM_SAVE_PERIOD 125000UL   // TMR1 ticks between warm saves, 250ms
 
 // PORT B encoder pins
 #define ENC_1A 5
@@ -55,129 +85,377 @@
 #define ENC_2A 7
 #define ENC_2B 6
 
-char go_flag = 0;           // Current pushbutton status
-char go_flag_0 = 0;         // Previous pushbutton status
-char button_state = 0;      // RB0 current state
-char button_state_0 = 0;    // RB0 previous state
-char count_lost = 0;        // Number of updates with a lost reading
-char count_stop = 0;        // Number of updates with a stop reading
-
-char adc_flag = 0;          // Flags the arrival of a new measurement
-short adc_reading = 0;      // Number of measurements from sensor
-char IR_meas_array = 0;     // Combined binary values of the sensorarray
-char IR_temp_array = 0;     // Buffer for the sensor array
-
-// structs for IRSensor data
-struct IRSensor IR_1 = {0b00000101, 0, 6, 1, 0};
-struct IRSensor IR_2 = {0b00001001, 1, 5, 0, 0};
-struct IRSensor IR_3 = {0b00001101, 2, 4, -1, 0};
-
-// current sensor loaded in the ADC and the one for next cycle
-struct IRSensor *sensor_read = &IR_1;
-struct IRSensor *sensor_next = &IR_1;
-
-// structs for Encoders
-struct Encoder encoder_A; 
-struct Encoder encoder_B;
-char encoder_readings_old = 0;
-
-char display_value = 0;     // Byte to display on the status array
-char blink_count = 0;       // Number of cycles for current blink status
+// Hardware features, the control features are in control.h
+#define ENCODER_AUTO 0      // 1 lowers decode resolution at high speed, the
+                            // RB change interrupt still fires on every edge
+#define ENCODER_MODE ENCODER_X4     // resolution when ENCODER_AUTO is 0
+#define ISR_PROBE 0         // 1 holds RD0 high while LoPriISR runs, to time it
 
 // function declarations
 void init(void);
+void run_ADC_characterization(void);
 void run_sleep_routine(void);
-void process_measurement(const short, char *, char *);
+void process_measurement(const short, char *);
 char update_sensor(char);
-void update_encoders(void);
-char convert_array_to_inputs(signed char *, signed char *, const char);
+void read_encoder_counts(int *, int *);
+void update_control(void);
+void update_sample_periods(int);
+char task_button(void);
+char task_measurement(void);
+char task_scan(void);
+char task_control(void);
+char task_abort(void);
+char task_commands(void);
+char task_display(void);
+char task_scan_rates(void);
+char task_telemetry(void);
+char task_freq_report(void);
+char task_sequence(void);
+char lost_sequence(struct Coroutine *);
+char dock_sequence(struct Coroutine *);
+
+// Main loop tasks, run in this order every pass
+struct Task tasks[] = {
+    {task_button, 0, TASK_CRITICAL},
+    {task_measurement, &ROBOT->adc_flag, TASK_CRITICAL},
+    {task_scan, &ROBOT->scan_flag, TASK_CRITICAL},
+    {task_control, &ROBOT->control_flag, TASK_CRITICAL},
+    {task_abort, 0, TASK_CRITICAL},
+    {task_commands, 0, TASK_NORMAL},
+    {task_display, &ROBOT->display_flag, TASK_BACKGROUND},
+    {task_scan_rates, &ROBOT->scan_rate_flag, TASK_BACKGROUND},
+    {task_telemetry, &ROBOT->telemetry_flag, TASK_BACKGROUND},
+    {task_freq_report, &ROBOT->freq.ready, TASK_NORMAL},
+    {task_sequence, 0, TASK_CRITICAL}
+};
 
 void main(void) {
 
     init();
-    char adc_reading_number = 0;
+    init_scheduler(tasks, sizeof(tasks) / sizeof(tasks[0]));
     
     while(1){
-        if (go_flag != go_flag_0){		
-            // The pushbutton has been pressed		
-            if (go_flag == 1){
-                execute_delivery();
-            }
-            
-            else if (go_flag == 0){
-                pause_delivery();
-            }
-            
-            go_flag_0 = go_flag;
+        CLRWDT();
+        run_scheduler();
+    }
+}
+
+char task_button(){
+    if (ROBOT->go_flag == ROBOT->go_flag_0){
+        return 0;
+    }
+    
+    // The pushbutton has been pressed
+    int count_right;
+    int count_left;
+    
+    read_encoder_counts(&count_right, &count_left);
+    
+    if (ROBOT->go_flag == 1){
+        char resume = delivery_stats_active();
+        
+        if (resume){
+            resume_delivery_stats();
         }
         
-        if (sensor_read == &IR_1 && adc_reading_number == 0){
-            // All sensors have been read, update the measurement array
-            IR_meas_array = IR_temp_array;
+        else {
+            start_delivery_stats(count_right, count_left);
         }
         
-        if (adc_flag != 0){
-            // New ADC reading, ADC is paused until measurement is processed
-            adc_reading_number += 1;
-            
-            if (adc_reading_number != 1){
-                // This is not the first measurment for this sensor
-                process_measurement(adc_reading, &IR_temp_array, &display_value);
-                adc_reading_number = update_sensor(adc_reading_number);
-            }
-                  
-            adc_flag = 0;
-            ADCON0bits.GO = 1;      //Start acquisition then conversion
-//            PIE1bits.ADIE = 1;
+        start_control(resume, count_right, count_left);
+        
+        // a press can cut a turn around short, stop before the lights
+        motors_brake();
+        start_coroutine(&ROBOT->sequence, execute_delivery);
+    }
+    
+    else if (ROBOT->go_flag == 0){
+        pause_delivery();
+        start_coroutine(&ROBOT->sequence, pause_sequence);
+        pause_delivery_stats();
+        engage_position_hold(&ROBOT->position_hold, count_right, count_left);
+        
+        if (ROBOT->position_hold.active){
+            // keep the control timestep running for the servo
+            ROBOT->control_restart = 1;
+            PIR4bits.CCP3IF = 0;
+            PIE4bits.CCP3IE = 1;
+        }
+    }
+    
+    ROBOT->go_flag_0 = ROBOT->go_flag;
+    save_warm_state(ROBOT->go_flag, count_right, count_left);
+    return 1;
+}
+
+char task_measurement(){
+    // New ADC reading, ADC is paused until measurement is processed
+    ROBOT->adc_reading_number += 1;
+    
+    if (ROBOT->adc_reading_number != 1){
+        // This is not the first measurment for this sensor
+        if (ROBOT->sensor_read == &ROBOT->battery_sensor){
+            update_battery_stats(ROBOT->adc_reading);
         }
         
-        if (count_lost > 10){
-            // stop
-            pause_delivery();
-            // flash lights
+        else {
+            int count_right;
+            int count_left;
             
-            for (int i = 0; i < 10; ++i){
-                load_byte(0xFF);
-                __delay_ms(100);
-                load_byte(0x00);
-                __delay_ms(100);
-            }
-                       
-            // back up
-            
-            // clean up
-            go_flag = 0;
-            go_flag_0 = 0;
-            count_lost = 0;
+            read_encoder_counts(&count_right, &count_left);
+            control_sample(ROBOT->sensor_read, ROBOT->adc_reading, 
+                    read_clock_ticks(), count_right, count_left);
+            process_measurement(ROBOT->adc_reading, &ROBOT->display_value);
         }
         
-        if (count_stop > 10){
-            // stop
-            pause_delivery();
-            // flash lights
-            for (int i = 0; i < 2; ++i){
-                load_byte(0xFF);
-                __delay_ms(1000);
-                load_byte(0x00);
-                __delay_ms(1000);
-            }
-            // turn around
-            motors_turn_around();
-            
-            // clean up
-            go_flag = 0;
-            go_flag_0 = 0;
-            count_stop = 0;
-            enter_sleep_mode();
+        ROBOT->adc_reading_number = update_sensor(ROBOT->adc_reading_number);
+    }
+    
+    ROBOT->adc_flag = 0;
+    ROBOT->adc_ready = 1;
+    return 1;
+}
+
+char task_scan(){
+    // Conversions are paced by the speed scaled scan timestep
+    if (ROBOT->adc_ready == 0){
+        return 0;
+    }
+    
+    ROBOT->adc_ready = 0;
+    ROBOT->scan_flag = 0;
+    ADCON0bits.GO = 1;      //Start acquisition then conversion
+    return 1;
+}
 
-            PIE1bits.ADIE = 1;  // Starts a new measurment cycle
+char task_control(){
+    ROBOT->control_flag = 0;
+    update_control();
+    ROBOT->telemetry_flag = ROBOT->telemetry_on;
+    
+    unsigned long ticks = read_clock_ticks();
+    
+    if (ticks - ROBOT->warm_ticks >= WARM_SAVE_PERIOD){
+        // a watchdog reset resumes from the counts and stats saved here
+        int count_right;
+        int count_left;
+        
+        read_encoder_counts(&count_right, &count_left);
+        save_warm_state(ROBOT->go_flag, count_right, count_left);
+        ROBOT->warm_ticks = ticks;
+    }
+    
+    return 1;
+}
+
+char task_abort(){
+    /*
+    Stops the run when the line is lost for good, the robot has docked or
+    docking has given up. The lost timeout doesn't run while docking, the
+    docking time limit stands in for it.
+    Everything that must happen at once is done here; the lights and the
+    turn around follow as a sequence, so a press of the button during them
+    is seen and starts the next run straight away.
+    */
+    int count_right;
+    int count_left;
+    
+    if (ROBOT->count_lost > LOST_TIMEOUT || 
+            ROBOT->docking.state == DOCK_FAILED){
+        // stop
+        char reason = ROBOT->docking.state == DOCK_FAILED ? LOG_DOCK_FAILED : 
+                LOG_LINE_LOST;
+        
+        pause_delivery();
+        read_encoder_counts(&count_right, &count_left);
+        finish_delivery_stats(reason, count_right, count_left);
+        TRACE(TRACE_MARK, reason);
+        
+        // clean up
+        ROBOT->go_flag = 0;
+        ROBOT->go_flag_0 = 0;
+        ROBOT->count_lost = 0;
+        reset_docking(&ROBOT->docking);
+        save_warm_state(ROBOT->go_flag, count_right, count_left);
+        start_coroutine(&ROBOT->sequence, lost_sequence);
+        return 1;
+    }
+    
+    if (ROBOT->docking.state == DOCK_DONE){
+        // docked at the station
+        pause_delivery();
+        read_encoder_counts(&count_right, &count_left);
+        finish_delivery_stats(LOG_COMPLETED, count_right, count_left);
+        TRACE(TRACE_MARK, LOG_COMPLETED);
+        
+        // clean up
+        ROBOT->go_flag = 0;
+        ROBOT->go_flag_0 = 0;
+        reset_docking(&ROBOT->docking);
+        save_warm_state(ROBOT->go_flag, count_right, count_left);
+        start_coroutine(&ROBOT->sequence, dock_sequence);
+        return 1;
+    }
+    
+    return 0;
+}
+
+char lost_sequence(struct Coroutine *co){
+    // Pause lights, then flash everything
+    CO_BEGIN(co);
+    CO_CALL(co, &ROBOT->sequence_call, pause_sequence);
+    
+    for (co->count = 0; co->count < 10; ++co->count){
+        load_byte(0xFF);
+        CO_SLEEP_MS(co, 100);
+        load_byte(0x00);
+        CO_SLEEP_MS(co, 100);
+    }
+    
+    // back up
+    CO_END(co);
+}
+
+char dock_sequence(struct Coroutine *co){
+    // Pause lights, flash, turn around and sleep until the next delivery
+    CO_BEGIN(co);
+    CO_CALL(co, &ROBOT->sequence_call, pause_sequence);
+    
+    for (co->count = 0; co->count < 2; ++co->count){
+        load_byte(0xFF);
+        CO_SLEEP_MS(co, 1000);
+        load_byte(0x00);
+        CO_SLEEP_MS(co, 1000);
+    }
+    
+    CO_CALL(co, &ROBOT->sequence_call, motors_turn_around);
+    enter_sleep_mode();
+    
+    PIE1bits.ADIE = 1;  // Starts a new measurment cycle
+    CO_END(co);
+}
+
+char task_sequence(){
+    // Steps the running light or motion sequence up to its next wait
+    return step_coroutine(&ROBOT->sequence);
+}
+
+char task_commands(){
+    char command;
+    
+    if (!uart_read(&command)){
+        return 0;
+    }
+    
+    if (command == 'D' && !delivery_stats_active()){
+        // Host asked for the delivery log
+        dump_delivery_log();
+    }
+    
+    else if (command == 'T'){
+        // Host asked for the event trace, nothing when built without it
+        dump_trace();
+    }
+    
+    else if (command == 'S'){
+        // Start or stop the telemetry stream, which opens with a keyframe
+        ROBOT->telemetry_on = ROBOT->telemetry_on ? 0 : 1;
+        reset_telemetry_encoder(&ROBOT->telemetry);
+    }
+    
+    else if (command == 'F'){
+        // Start or stop the steering frequency response sweep. Its report
+        // shares the UART, so the telemetry stream stops
+        if (ROBOT->freq.active){
+            stop_freq_response(&ROBOT->freq);
         }
         
+        else {
+            ROBOT->telemetry_on = 0;
+            start_freq_response(&ROBOT->freq);
+        }
+    }
+    
+    return 1;
+}
+
+char task_display(){
+    // DISPLAY timestep, update alive LED and load display
+    ROBOT->display_flag = 0;
+    ROBOT->blink_count = blink_handler(ROBOT->blink_count, 
+            &ROBOT->display_value);
+    
+    if (ROBOT->sequence.run == 0){
+        // a running sequence owns the display
+        load_byte(ROBOT->display_value);
+    }
+    return 1;
+}
+
+char task_scan_rates(){
+    // A rate window has elapsed, report samples per second. The governor
+    // may drop windows, so the length is measured rather than assumed
+    unsigned long ticks = read_clock_ticks();
+    
+    update_scan_rates(&ROBOT->IR_1, ticks - ROBOT->scan_rate_ticks);
+    ROBOT->scan_rate_ticks = ticks;
+    ROBOT->scan_rate_flag = 0;
+    return 1;
+}
+
+char task_telemetry(){
+    /*
+    Sends the state after a CONTROL timestep as one compressed record, see
+    telemetry_codec.h. Records dropped by the governor only show as a
+    larger step in the time channel, which counts in 512 TMR1 ticks.
+    */
+    short values[TELEMETRY_CHANNELS];
+    unsigned char record[TELEMETRY_RECORD_MAX];
+    int count_right;
+    int count_left;
+    
+    ROBOT->telemetry_flag = 0;
+    read_encoder_counts(&count_right, &count_left);
+    
+    values[0] = (short)(read_clock_ticks() >> 9);
+    values[1] = ROBOT->IR_1.reading;
+    values[2] = ROBOT->IR_2.reading;
+    values[3] = ROBOT->IR_3.reading;
+    values[4] = (short)count_right;
+    values[5] = (short)count_left;
+    values[6] = (short)ROBOT->wheel_speed;
+    values[7] = ROBOT->IR_meas_array | (ROBOT->IR_failed << 4);
+    
+    unsigned char length = encode_telemetry(&ROBOT->telemetry, values, record);
+    
+    for (unsigned char i = 0; i < length; ++i){
+        putch((char)record[i]);
     }
+    
+    return 1;
+}
+
+char task_freq_report(){
+    /*
+    Sends one finished frequency of the steering response test as
+    "F centihz samples u_sin u_cos c_sin c_cos y_sin y_cos", for
+    tools/freq_response.c to turn into gain and phase.
+    */
+    struct FreqPoint *point = &ROBOT->freq.result;
+    
+    ROBOT->freq.ready = 0;
+    printf("F %u %u %ld %ld %ld %ld %ld %ld\r\n", point->centihz, 
+            point->samples, point->u_sin, point->u_cos, point->c_sin, 
+            point->c_cos, point->y_sin, point->y_cos);
+    return 1;
 }
 
 void init(){
     OSCCONbits.IDLEN = 0;
+    init_robot(ROBOT);
+    
+    char warm = check_warm_restart();
+    clear_reset_flags();
     
     // TMR1
     T1CON = 0b00110101;             // On, PS8
@@ -189,6 +467,19 @@ void init(){
     IPR4bits.CCP3IP = 0;            // low pri
     PIE4bits.CCP3IE = 0;            // enable
     
+    CCP2CON = 0b00001010;           // Compare generates software interrupt
+    CCPTMRS0bits.C2TSEL2 = 0;       // CCP2 -> TMR1
+    CCPTMRS0bits.C2TSEL1 = 0;
+    CCPTMRS0bits.C2TSEL0 = 0;
+    PIR3bits.CCP2IF = 0;            // clear flag
+    IPR3bits.CCP2IP = 0;            // low pri
+    PIE3bits.CCP2IE = 1;            // enable
+    
+    if (ISR_PROBE){
+        TRISDbits.TRISD0 = 0;       // scope probe output
+        LATDbits.LATD0 = 0;
+    }
+    
     RCONbits.IPEN = 1;              // Enable priority levels
     INTCONbits.GIEL = 1;            // Enable low-priority interrupts to CPU
     INTCONbits.GIEH = 1;            // Enable all interrupts
@@ -197,20 +488,46 @@ void init(){
     init_SPI();
     init_display();
     init_go_button();
-    init_ADC(sensor_next);
+    init_UART();
+    init_clock(warm);
+    init_delivery_log(warm);
+    init_ADC(ROBOT->sensor_next);
 
+    // Decode table first, init_encoder briefly enables the edge interrupt
+    set_encoder_mode(ENCODER_MODE);
+    
     // Fills Encoder struct
-    encoder_A = init_encoder(ENC_1A, ENC_1B);
-    encoder_B = init_encoder(ENC_2A, ENC_2B);
+    ROBOT->encoder_A = init_encoder(ENC_1A, ENC_1B);
+    ROBOT->encoder_B = init_encoder(ENC_2A, ENC_2B);
     stop_encoders();
+    init_control();
     
     init_motors();
+    init_battery_ADC();
     
-    // Updates IRSensor struct values
-    IR_1.next_sensor = &IR_2;
-    IR_2.next_sensor = &IR_3;
-    IR_3.next_sensor = &IR_1; 
+    if (PORTBbits.RB0){
+        // Button held at power up, pick the ADC profile from measurements
+        run_ADC_characterization();
+    }
 
+    if (warm){
+        // Reset during operation, skip the light show and carry on
+        ROBOT->encoder_A.count = warm_state.count_right;
+        ROBOT->encoder_B.count = warm_state.count_left;
+        
+        if (warm_state.go_flag == 1){
+            ROBOT->go_flag = 1;
+            ROBOT->go_flag_0 = 1;
+            resume_delivery();
+            return;
+        }
+        
+        Sleep();
+        return;
+    }
+    
+    save_warm_state(0, 0, 0);
+    
     // Start up light show   
     for (int i = 0; i < 2; ++i){
         load_byte(0xFF);
@@ -224,22 +541,49 @@ void init(){
 
 
 
-void process_measurement(const short reading, char *meas, char *disp){
+void run_ADC_characterization(){
+    /*
+    Measures every ADC timing profile with the robot over a static surface,
+    reports the results over the UART and keeps the fastest profile whose
+    noise is below ADC_NOISE_LIMIT.
+    */
+    struct ADCProfileStats stats[ADC_PROFILES];
+    
+    load_byte(0xFF);
+    ADCON0bits.ADON = 1;
+    char chosen = characterize_ADC(&ROBOT->IR_1, stats, ADC_NOISE_LIMIT);
+    ADCON0 = ROBOT->sensor_next->adcon0_value;     // back to the scan's channel
+    ADCON0bits.ADON = 0;
+    
+    for (char p = 0; p < ADC_PROFILES; ++p){
+        printf("ADC profile %u: %u conv/s, noise", p, 
+                stats[p].conversions_per_second);
+        
+        for (char i = 0; i < CHARACTERIZE_SENSORS; ++i){
+            printf(" %u.%u", stats[p].noise[i] / 10, stats[p].noise[i] % 10);
+        }
+        
+        printf("\r\n");
+    }
+    
+    printf("ADC profile %u selected\r\n", chosen);
+    load_byte(0x00);
+}
+
+void process_measurement(const short reading, char *disp){
     /* 
-    Updates the measurement char to contain a 1 if the sensor is reading above
-    ADC_CUTOFF, and 0 if not. Addtionally, these results are mirrored in the
-    display char which will be passed to the LED array.
+    Mirrors whether the sensor is reading above ADC_CUTOFF in the display
+    char which will be passed to the LED array. The pattern itself is kept
+    by control_sample().
     */
     char val = convert_measurement_to_binary(reading, ADC_CUTOFF);
     
     if (val){
-        *meas |= 1 << (sensor_read->index);     // set bit
-        *disp |= 1 << (sensor_read->led);       // set bit
+        *disp |= 1 << (ROBOT->sensor_read->led);       // set bit
     }
     
     else {
-        *meas &= ~(1 << (sensor_read->index));  // clear bit
-        *disp &= ~(1 << (sensor_read->led));    // clear bit
+        *disp &= ~(1 << (ROBOT->sensor_read->led));    // clear bit
     }
     
 }
@@ -248,131 +592,141 @@ void process_measurement(const short reading, char *meas, char *disp){
 char update_sensor(char reading){  
     /*
     If the ADC measurement being collected is the last one for this sensor
-    based on READINGS_MAX, then load the next sensor. The next time this
-    subroutine is called, sensor_next will not equal sensor_read and the new
-    sensor, which is currently being read, will be loaded into sensor_read.
+    based on READINGS_MAX, then load the next sensor chosen by the adaptive
+    scan. The next time this subroutine is called, sensor_next will not equal
+    sensor_read and the new sensor, which is currently being read, will be
+    loaded into sensor_read. If the scan picks the same sensor again it keeps
+    sampling without discarding a reading.
     */
     
-    if (sensor_next != sensor_read){
+    if (ROBOT->sensor_next != ROBOT->sensor_read){
         // This was the last measurement from read
-        sensor_read = sensor_next;
+        ROBOT->sensor_read = ROBOT->sensor_next;
         reading = 0;
     }
 
-    else if (reading == READINGS_MAX){
+    else if (reading >= READINGS_MAX){
         // the in progress measurement will be the last one
-        sensor_next = sensor_read->next_sensor;
+        if (ROBOT->battery_flag && 
+                ROBOT->sensor_read != &ROBOT->battery_sensor){
+            // slot a battery sample in between two sensors
+            ROBOT->sensor_next = &ROBOT->battery_sensor;
+            ROBOT->battery_flag = 0;
+        }
+        
+        else {
+            ROBOT->sensor_next = scan_next_sensor(ROBOT->sensor_read, 
+                    ROBOT->IR_meas_array);
+        }
+        
+        if (ROBOT->sensor_next == ROBOT->sensor_read){
+            // same channel again, no settling reading to throw away
+            reading = 1;
+        }
     } 
     
     return reading;
 }
 
 
-void update_encoders(){
+void read_encoder_counts(int *count_right, int *count_left){
+    // The low priority ISR writes the counts a byte at a time
+    INTCONbits.GIEL = 0;
+    *count_right = ROBOT->encoder_A.count;
+    *count_left = ROBOT->encoder_B.count;
+    INTCONbits.GIEL = 1;
+}
+
+
+void update_control(){
     /*
-    When a new encoder value comes in, the lookup_table is referenced to
-    determinee whether to increment or decrement the encoder.
+    Runs every CONTROL timestep from the main loop. Reads the clock and the
+    encoders, runs the control step and applies its duties to the motors.
     */
-
-    static signed char lookup_table[] = {   
-        0, -1, 1, 0, 
-        1, 0, 0, -1,
-        -1, 0, 0, 1, 
-        0, 1, -1, 0
-    }; 
+    signed char DCRight;
+    signed char DCLeft;
+    char status;
+    int count_right;
+    int count_left;
     
-    char enc_dual = (PORTB & 0xF0) >> 4;
-            
-    encoder_A.reading = encoder_A.reading << 2;
-    char test = (enc_dual & 0b0011);
-    encoder_A.reading = encoder_A.reading | test;
-    encoder_A.count += lookup_table[encoder_A.reading & 0x0F];
+    read_encoder_counts(&count_right, &count_left);
+    status = control_step(read_clock_ticks(), count_right, count_left, 
+            &DCRight, &DCLeft);
+    update_sample_periods(ROBOT->wheel_speed);
+    
+    if (ENCODER_AUTO){
+        char mode = select_encoder_mode(ROBOT->encoder_mode, 
+                ROBOT->wheel_speed);
+        
+        if (mode != ROBOT->encoder_mode){
+            set_encoder_mode(mode);
+        }
+    }
+    
+    if (status <= CONTROL_MARKER){
+        update_delivery_stats(status);
+    }
+    
+    if (status == CONTROL_BRAKE){
+        motors_brake();
+    }
+    
+    else if (status != CONTROL_LOST){
+        motors_drive(DCRight, DCLeft);
+    }
 }
 
 
-char convert_array_to_inputs(signed char *dcR, signed char *dcL, const char meas){
+void update_sample_periods(int speed){
     /*
-    Takes the most recent sensor array values and sets the appropriate
-    proportional control duty cycle value for each motor.
-    */    
+    Scales the scan and control timesteps with the forward speed in mm/s.
+    Both periods are read by the ISR, so they are written with low priority
+    interrupts held off.
+    */
+    if (speed < 0){
+        speed = -speed;
+    }
     
-    char status;
-    // status 0: normal operation
-    //        1: no signal / erroneous signal
-    //        2: stop signal
-    
-    switch(meas){
-        case 0 :        // 000  no signal
-            status = 1;
-            break;
-        case 5 :        // 101  not sure
-            status = 1;
-            break;
-        case 7 :        // 111  stop signal
-            status = 2;
-            break;
-        case 1 :        // 001 line left
-            *dcR = 50;
-            *dcL = 0;
-            status = 0;
-            break;
-        case 3 :        // 011 line slight left
-            *dcR = 35;
-            *dcL = 15;
-            status = 0;
-            break;
-        case 2 :        // 010 line center
-            *dcR = 25;
-            *dcL = 25;
-            status = 0;
-            break;
-        case 6 :        // 110 line slight right
-            *dcR = 15;
-            *dcL = 35;
-            status = 0;
-            break;
-        case 4 :        // 100 line right
-            *dcR = 0;
-            *dcL = 50;
-            status = 0;
-            break;             
-    }
-    
-    return status;
+    unsigned short scan = scan_period_for_speed(speed);
+    unsigned short control = control_period(speed);
+    
+    INTCONbits.GIEL = 0;
+    ROBOT->scan_period = scan;
+    ROBOT->control_period = control;
+    INTCONbits.GIEL = 1;
 }
 
 
+
+
 /******************************************************************************
  * HiPriISR interrupt service routine
  ******************************************************************************/
 
 void __interrupt() HiPriISR(void) {
+    // Single pass, a source that fires while servicing re-enters on return
+    TRACE(TRACE_ISR_ENTER, 1);
     
-    while(1) {
-        if (PIR1bits.SSP1IF) {
-            // SPI is ready
-	    display_byte();
-            PIR1bits.SSP1IF = 0;
-            continue;
-        }
-        
-        else if (INTCONbits.INT0IF){
-            // Pushbutton state change
-            CCPR7L = TMR1L + (char)(DEBOUNCE & 0x00FF);
-            CCPR7H = TMR1H + (char)((DEBOUNCE >> 8) & 0x00FF);
-            PIR4bits.CCP7IF = 0;
-            PIE4bits.CCP7IE = 1;
-
-            INTCONbits.INT0IE = 0; // disable interrupt until debounce complete
-            INTCONbits.INT0IF = 0;
-            
-            button_state_0 = PORTBbits.RB0;
-            continue;
-        }   
-        
+    if (PIR1bits.SSP1IF) {
+        // SPI is ready
+        display_byte();
+        PIR1bits.SSP1IF = 0;
+    }
+    
+    if (INTCONbits.INT0IF && INTCONbits.INT0IE){
+        // Pushbutton state change
+        CCPR7L = TMR1L + (char)(DEBOUNCE & 0x00FF);
+        CCPR7H = TMR1H + (char)((DEBOUNCE >> 8) & 0x00FF);
+        PIR4bits.CCP7IF = 0;
+        PIE4bits.CCP7IE = 1;
+
+        INTCONbits.INT0IE = 0; // disable interrupt until debounce complete
+        INTCONbits.INT0IF = 0;
         
-        break;      
+        ROBOT->button_state_0 = PORTBbits.RB0;
     }
+    
+    TRACE(TRACE_ISR_EXIT, 1);
 }
 
 
@@ -383,78 +737,118 @@ void __interrupt() HiPriISR(void) {
 
 void __interrupt(low_priority) LoPriISR(void) 
 {
-    // Save temp copies of WREG, STATUS and BSR if needed.
-    while(1) {
-        if( PIR1bits.ADIF){    
-	    // ADC acquisition finished
-            adc_reading = read_and_update_ADC(sensor_next);
-            adc_flag = 1;
-            PIR1bits.ADIF = 0;              
-            continue;
-        }
+    /*
+    The flag and enable registers are read once and every pending source is
+    serviced in priority order: encoders, ADC, uptime, debounce, display,
+    control. Handlers are inline and call-free so XC8 only saves the few
+    registers used here; display and control work is flagged for the main
+    loop. A source that fires while servicing re-enters on return.
+    
+    The cycles per interrupt have not been measured. Counted by hand, the
+    dispatch for a lone encoder edge is about 25 cycles against about 30
+    for the old polling loop. Any larger saving comes from the context XC8
+    no longer saves for calls, which only the compiler listing or a scope on
+    ISR_PROBE will show.
+    */
+    char intcon = INTCON;
+    char pir1 = PIR1 & PIE1;
+    char pir3 = PIR3 & PIE3;
+    char pir4 = PIR4 & PIE4;
+    unsigned short compare;
+    
+    if (ISR_PROBE){
+        LATDbits.LATD0 = 1;
+    }
+    
+    TRACE(TRACE_ISR_ENTER, 0);
+    
+    if ((intcon & _INTCON_RBIF_MASK) && (intcon & _INTCON_RBIE_MASK)){
+        // Encoder edge, both wheels decoded from one PORTB read
+        char enc_dual = PORTB >> 4;
         
-        else if (INTCONbits.RBIF){
-            // External encoder interrupt detected
-            update_encoders();
-            INTCONbits.RBIF = 0;
-            continue;
-        }
+        ROBOT->encoder_A.reading = (ROBOT->encoder_A.reading << 2) | 
+                                   (enc_dual & 0b0011);
+        ROBOT->encoder_A.count += 
+                ROBOT->encoder_steps[ROBOT->encoder_A.reading & 0x0F];
         
-        else if (PIR4bits.CCP7IF && PIE4bits.CCP7IE){
-            // Debounce time is over
-            button_state = PORTBbits.RB0;
-            
-            if (button_state && button_state_0){ // both high
-                go_flag = go_button_handler(go_flag);
-            }
-            
-            PIE4bits.CCP7IE = 0;        // disable CCP7
-            PIR4bits.CCP7IF = 0;
-            INTCONbits.INT0IF = 0;
-            INTCONbits.INT0IE = 1;      // enable external interrupt
-            continue;   
+        // Left wheel is mirrored, so its count is negated to read forward
+        ROBOT->encoder_B.reading = (ROBOT->encoder_B.reading << 2) | 
+                                   ((enc_dual >> 2) & 0b0011);
+        ROBOT->encoder_B.count -= 
+                ROBOT->encoder_steps[ROBOT->encoder_B.reading & 0x0F];
+        INTCONbits.RBIF = 0;
+    }
+    
+    if (pir1 & _PIR1_ADIF_MASK){
+        // ADC acquisition finished, load the channel for the next one
+        ROBOT->adc_reading = (ADRESH << 8) | ADRESL;
+        ADCON0 = ROBOT->sensor_next->adcon0_value;
+        ROBOT->adc_flag = 1;
+        PIR1bits.ADIF = 0;
+    }
+    
+    if (pir3 & _PIR3_CCP2IF_MASK){
+        // Scan timestep, main loop may start the next conversion
+        compare = ((unsigned short)CCPR2H << 8 | CCPR2L) + ROBOT->scan_period;
+        CCPR2L = (char)(compare & 0x00FF);
+        CCPR2H = (char)(compare >> 8);
+        ROBOT->scan_flag = 1;
+        PIR3bits.CCP2IF = 0;
+    }
+    
+    if (pir1 & _PIR1_TMR1IF_MASK){
+        // Uptime, and scan rate and battery windows every ~1s
+        ++clock_overflows;
+        
+        if (((char)clock_overflows & (SCAN_RATE_OVERFLOWS - 1)) == 0){
+            ROBOT->scan_rate_flag = 1;
+            ROBOT->battery_flag = 1;
         }
         
-        else if (PIR4bits.CCP6IF){
-            // Update alive LED and load display
-            CCPR6L += (char)(DISPLAY & 0x00FF);
-            CCPR6H += (char)((DISPLAY >> 8) & 0x00FF);
-            
-            blink_count = blink_handler(blink_count, &display_value);
-            load_byte(display_value);
-            PIR4bits.CCP6IF = 0;
-            continue;
+        PIR1bits.TMR1IF = 0;
+    }
+    
+    if (pir4 & _PIR4_CCP7IF_MASK){
+        // Debounce time is over
+        ROBOT->button_state = PORTBbits.RB0;
+        
+        if (ROBOT->button_state && ROBOT->button_state_0){ // both high
+            ROBOT->go_flag = ROBOT->go_flag ? 0 : 1;
+            TRACE(TRACE_STATE, TRACE_STATE_GO | ROBOT->go_flag);
         }
-
         
-        else if (PIR4bits.CCP3IF){
-            // Time to update the outputs
-            CCPR3L += (char)(CONTROL & 0x00FF);
-            CCPR3H += (char)((CONTROL >> 8) & 0x00FF);
-            
-            signed char DCRight;
-            signed char DCLeft;
-            char status;
-            
-            status = convert_array_to_inputs(&DCRight, &DCLeft, IR_meas_array);
-            
-            if (status == 0){
-                // normal signal received
-                motors_drive(DCRight, DCLeft);
-                count_lost = 0;
-                count_stop = 0;
-            }
-            
-            else if (status == 1)
-                ++count_lost;
-            
-            else if (status == 2)
-                ++count_stop;
-            
-            PIR4bits.CCP3IF = 0;
-            continue;
+        PIE4bits.CCP7IE = 0;        // disable CCP7
+        PIR4bits.CCP7IF = 0;
+        INTCONbits.INT0IF = 0;
+        INTCONbits.INT0IE = 1;      // enable external interrupt
+    }
+    
+    if (pir4 & _PIR4_CCP6IF_MASK){
+        // Update alive LED and load display
+        compare = ((unsigned short)CCPR6H << 8 | CCPR6L) + DISPLAY;
+        CCPR6L = (char)(compare & 0x00FF);
+        CCPR6H = (char)(compare >> 8);
+        ROBOT->display_flag = 1;
+        PIR4bits.CCP6IF = 0;
+    }
+    
+    if (pir4 & _PIR4_CCP3IF_MASK){
+        // Time to update the outputs, an unserviced one is a missed deadline
+        if (ROBOT->control_flag){
+            ++deadline_misses;
         }
         
-        break;  
+        compare = ((unsigned short)CCPR3H << 8 | CCPR3L) + 
+                  ROBOT->control_period;
+        CCPR3L = (char)(compare & 0x00FF);
+        CCPR3H = (char)(compare >> 8);
+        ROBOT->control_flag = 1;
+        PIR4bits.CCP3IF = 0;
+    }
+    
+    TRACE(TRACE_ISR_EXIT, 0);
+    
+    if (ISR_PROBE){
+        LATDbits.LATD0 = 0;
     }
 }
@@ -103,27 +103,31 @@ void motors_disengage(){
     STBY = 0;
 }
 
-void motors_turn_around(){
+char motors_turn_around(struct Coroutine *co){
+    CO_BEGIN(co);
     motors_drive(25, -25);
-    __delay_ms(3000);
+    CO_SLEEP_MS(co, 3000);
+    CO_END(co);
 }
 
-void motors_test(){
-       motors_drive(25, 25);
-        __delay_ms(1000);
-        
-        motors_brake();
-        __delay_ms(1000);
-        
-        motors_drive(-50, -50);
-        __delay_ms(1000);
-        
-        motors_brake();
-        __delay_ms(1000);
-        
-        motors_drive(-25, 75);
-        __delay_ms(1000);
-        
-        motors_brake();
-        __delay_ms(1000);
+char motors_test(struct Coroutine *co){
+    CO_BEGIN(co);
+    motors_drive(25, 25);
+    CO_SLEEP_MS(co, 1000);
+    
+    motors_brake();
+    CO_SLEEP_MS(co, 1000);
+    
+    motors_drive(-50, -50);
+    CO_SLEEP_MS(co, 1000);
+    
+    motors_brake();
+    CO_SLEEP_MS(co, 1000);
+    
+    motors_drive(-25, 75);
+    CO_SLEEP_MS(co, 1000);
+    
+    motors_brake();
+    CO_SLEEP_MS(co, 1000);
+    CO_END(co);
 }
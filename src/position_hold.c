@@ -0,0 +1,68 @@
+/*
+ * File:   position_hold.c
+ * Author: Jack
+ *
+ * Created on December 7, 2020, 7:45 PM
+ */
+
+#include <position_hold.h>
+
+#define HOLD_KP 3           // duty cycle per count of position error
+#define HOLD_DEADBAND 2     // counts of error ignored to stop hunting
+#define HOLD_DUTY_MAX 30    // duty cycle limit, bounds the holding current
+
+static signed char hold_effort(int error);
+
+void init_position_hold(struct PositionHold *hold, char enabled){
+    hold->enabled = enabled;
+    hold->active = 0;
+    hold->target_right = 0;
+    hold->target_left = 0;
+}
+
+void engage_position_hold(struct PositionHold *hold, int count_right, int count_left){
+    /*
+    Latches the current encoder counts as the position to hold. Does nothing
+    if the mode is disabled, so the caller can engage unconditionally.
+    */
+    if (!hold->enabled){
+        return;
+    }
+    
+    hold->target_right = count_right;
+    hold->target_left = count_left;
+    hold->active = 1;
+}
+
+void release_position_hold(struct PositionHold *hold){
+    hold->active = 0;
+}
+
+void update_position_hold(struct PositionHold *hold, int count_right, 
+        int count_left, signed char *dcR, signed char *dcL){
+    /*
+    Proportional servo on each wheel independently. The output is clamped
+    to HOLD_DUTY_MAX so a robot pushed against an obstacle never draws more
+    than a fraction of the stall current.
+    */
+    *dcR = hold_effort(hold->target_right - count_right);
+    *dcL = hold_effort(hold->target_left - count_left);
+}
+
+static signed char hold_effort(int error){
+    if (error <= HOLD_DEADBAND && error >= -HOLD_DEADBAND){
+        return 0;
+    }
+    
+    int effort = HOLD_KP * error;
+    
+    if (effort > HOLD_DUTY_MAX){
+        effort = HOLD_DUTY_MAX;
+    }
+    
+    else if (effort < -HOLD_DUTY_MAX){
+        effort = -HOLD_DUTY_MAX;
+    }
+    
+    return (signed char)effort;
+}
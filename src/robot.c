@@ -0,0 +1,86 @@
+/*
+ * File:   robot.c
+ * Author: Jack
+ *
+ * Created on December 22, 2020, 9:30 AM
+ */
+
+#include <string.h>
+#include <robot.h>
+#include <sample_rates.h>
+
+#ifdef __XC8
+struct Robot robot;
+#else
+_Thread_local struct Robot *robot_context;
+#endif
+
+static struct IRSensor *rebase_sensor(struct Robot *, const struct Robot *,
+        const struct IRSensor *);
+
+void init_robot(struct Robot *r){
+    /*
+    Power on state of one robot: everything clear, the sensors linked into
+    their ring and the slowest timesteps until the speed is known. The
+    encoder decode table is chosen by set_encoder_mode() in init().
+    */
+    memset(r, 0, sizeof(*r));
+    
+    r->IR_1.adcon0_value = 0b00000101;      // AN1
+    r->IR_1.index = 0;
+    r->IR_1.led = 6;
+    r->IR_1.position = 1;
+    r->IR_1.next_sensor = &r->IR_2;
+    
+    r->IR_2.adcon0_value = 0b00001001;      // AN2
+    r->IR_2.index = 1;
+    r->IR_2.led = 5;
+    r->IR_2.position = 0;
+    r->IR_2.next_sensor = &r->IR_3;
+    
+    r->IR_3.adcon0_value = 0b00001101;      // AN3
+    r->IR_3.index = 2;
+    r->IR_3.led = 4;
+    r->IR_3.position = -1;
+    r->IR_3.next_sensor = &r->IR_1;
+    
+    r->battery_sensor.adcon0_value = 0b00010101;    // AN5
+    r->battery_sensor.next_sensor = &r->IR_1;
+    
+    r->sensor_read = &r->IR_1;
+    r->sensor_next = &r->IR_1;
+    
+    r->scan_period = SCAN_PERIOD_MAX;
+    r->control_period = CONTROL_PERIOD_MAX;
+}
+
+void copy_robot(struct Robot *dst, const struct Robot *src){
+    /*
+    Copies the whole state of one robot to another, for snapshots and forks
+    in the host simulator. The sensor ring and the sensor_read/next
+    pointers point into the struct itself, so they are moved across to the
+    copy's own sensors.
+    */
+    memcpy(dst, src, sizeof(*dst));
+    
+    dst->IR_1.next_sensor = rebase_sensor(dst, src, src->IR_1.next_sensor);
+    dst->IR_2.next_sensor = rebase_sensor(dst, src, src->IR_2.next_sensor);
+    dst->IR_3.next_sensor = rebase_sensor(dst, src, src->IR_3.next_sensor);
+    dst->battery_sensor.next_sensor = rebase_sensor(dst, src, 
+            src->battery_sensor.next_sensor);
+    dst->sensor_read = rebase_sensor(dst, src, src->sensor_read);
+    dst->sensor_next = rebase_sensor(dst, src, src->sensor_next);
+}
+
+static struct IRSensor *rebase_sensor(struct Robot *dst, 
+        const struct Robot *src, const struct IRSensor *sensor){
+    // Same sensor in dst, pointers from outside the struct are kept
+    const char *base = (const char *)src;
+    const char *at = (const char *)sensor;
+    
+    if (sensor == 0 || at < base || at >= base + sizeof(*src)){
+        return (struct IRSensor *)sensor;
+    }
+    
+    return (struct IRSensor *)((char *)dst + (at - base));
+}
@@ -0,0 +1,54 @@
+/*
+ * File:   sample_rates.c
+ * Author: Jack
+ *
+ * Created on December 16, 2020, 9:30 PM
+ */
+
+#include <sample_rates.h>
+#include <clock.h>
+
+#define FRAME_MM 2              // travel per complete sensor frame
+#define FRAME_CONVERSIONS 6     // 3 sensors, settling reading plus sample
+#define CONTROL_FRAMES 5        // sensor frames per control update
+
+static unsigned long frame_period(unsigned short);
+static unsigned short clamp_period(unsigned long, unsigned short, 
+        unsigned short);
+
+unsigned short scan_period_for_speed(unsigned short speed){
+    /*
+    TMR1 ticks between ADC conversions at speed mm/s so that a full frame
+    is taken every FRAME_MM, bounded by what the CPU can process and by the
+    minimum refresh rate.
+    */
+    return clamp_period(frame_period(speed) / FRAME_CONVERSIONS, 
+            SCAN_PERIOD_MIN, SCAN_PERIOD_MAX);
+}
+
+unsigned short control_period_for_speed(unsigned short speed){
+    // TMR1 ticks between control updates, one every CONTROL_FRAMES frames
+    return clamp_period(frame_period(speed) * CONTROL_FRAMES, 
+            CONTROL_PERIOD_MIN, CONTROL_PERIOD_MAX);
+}
+
+static unsigned long frame_period(unsigned short speed){
+    if (speed == 0){
+        return 0xFFFFFFFF / CONTROL_FRAMES;
+    }
+    
+    return FRAME_MM * TMR1_HZ / speed;
+}
+
+static unsigned short clamp_period(unsigned long period, unsigned short min,
+        unsigned short max){
+    if (period < min){
+        return min;
+    }
+    
+    if (period > max){
+        return max;
+    }
+    
+    return (unsigned short)period;
+}
@@ -0,0 +1,140 @@
+/*
+ * File:   scheduler.c
+ * Author: Jack
+ *
+ * Created on December 18, 2020, 8:05 PM
+ */
+
+#include <xc.h>
+#include <scheduler.h>
+#include <clock.h>
+#include <trace.h>
+
+#define GOVERNOR_WINDOW 50000U  // TMR1 ticks per utilization window, 100ms
+#define LOAD_HIGH 80            // percent busy that sheds another level
+#define LOAD_LOW 50             // percent busy that restores a level
+#define SHED_LEVELS 5
+#define DECIMATION 4            // events per run for a decimated class
+
+/*
+Decimation and suspension applied to the NORMAL and BACKGROUND classes at
+each shed level. CRITICAL tasks are never touched.
+*/
+static const char shed_table[SHED_LEVELS][2][2] = {
+    // {NORMAL decimation, suspended}, {BACKGROUND decimation, suspended}
+    {{1, 0}, {1, 0}},
+    {{1, 0}, {DECIMATION, 0}},
+    {{1, 0}, {1, 1}},
+    {{DECIMATION, 0}, {1, 1}},
+    {{1, 1}, {1, 1}}
+};
+
+char cpu_utilization = 0;
+char shed_level = 0;
+char deadline_misses = 0;
+
+static struct Task *task_table;
+static char task_count;
+static unsigned long busy_ticks = 0;
+static unsigned long window_start = 0;
+
+static void update_governor(void);
+static void apply_shed_level(void);
+
+void init_scheduler(struct Task *tasks, char count){
+    task_table = tasks;
+    task_count = count;
+    shed_level = 0;
+    apply_shed_level();
+    window_start = read_clock_ticks();
+}
+
+void run_scheduler(){
+    /*
+    One pass over the task table in order. Flagged tasks only run when their
+    flag is set; a decimated task drops the events in between by clearing
+    the flag itself. Time spent in tasks that did work counts as busy.
+    */
+    for (char i = 0; i < task_count; ++i){
+        struct Task *task = &task_table[i];
+        
+        if (task->flag != 0 && *task->flag == 0){
+            continue;
+        }
+        
+        if (task->suspended || ++task->skipped < task->decimation){
+            if (task->flag != 0){
+                *task->flag = 0;
+            }
+            
+            continue;
+        }
+        
+        task->skipped = 0;
+        
+        unsigned long start = read_clock_ticks();
+        char worked;
+        
+        TRACE(TRACE_TASK_START, i);
+        worked = task->run();
+        TRACE(TRACE_TASK_STOP, i);
+        
+        if (worked){
+            busy_ticks += read_clock_ticks() - start;
+        }
+    }
+    
+    update_governor();
+}
+
+static void update_governor(){
+    /*
+    At the end of every window, sheds one more level when the CPU was busy
+    above LOAD_HIGH or a CONTROL timestep was overrun, and restores one
+    level once it is back under LOAD_LOW with no overruns. Both clocks are
+    the 32-bit tick count, a task or pass longer than a TMR1 wrap (131ms)
+    would otherwise be measured short.
+    */
+    unsigned long elapsed = read_clock_ticks() - window_start;
+    
+    if (elapsed < GOVERNOR_WINDOW){
+        return;
+    }
+    
+    unsigned long load = busy_ticks * 100 / elapsed;
+    cpu_utilization = load > 100 ? 100 : (char)load;
+    
+    if ((cpu_utilization > LOAD_HIGH || deadline_misses != 0) && 
+            shed_level < SHED_LEVELS - 1){
+        ++shed_level;
+        apply_shed_level();
+    }
+    
+    else if (cpu_utilization < LOAD_LOW && deadline_misses == 0 && 
+            shed_level > 0){
+        --shed_level;
+        apply_shed_level();
+    }
+    
+    busy_ticks = 0;
+    deadline_misses = 0;
+    window_start += elapsed;
+}
+
+static void apply_shed_level(){
+    TRACE(TRACE_STATE, TRACE_STATE_SHED | shed_level);
+    
+    for (char i = 0; i < task_count; ++i){
+        struct Task *task = &task_table[i];
+        
+        if (task->criticality == TASK_CRITICAL){
+            task->decimation = 1;
+            task->suspended = 0;
+            continue;
+        }
+        
+        const char *policy = shed_table[shed_level][task->criticality - 1];
+        task->decimation = policy[0];
+        task->suspended = policy[1];
+    }
+}
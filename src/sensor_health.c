@@ -0,0 +1,182 @@
+/*
+ * File:   sensor_health.c
+ * Author: Jack
+ *
+ * Created on January 3, 2021, 9:00 AM
+ */
+
+#include <sensor_health.h>
+
+#define HEALTH_RANGE_MIN 0       // readings below this mean an open or
+                                 // shorted sensor, 0 until the lowest floor
+                                 // reading less its noise is measured
+#define HEALTH_SATURATED 4095    // full scale, a sensor over black reads it
+#define HEALTH_STUCK_MAX 100     // identical readings in a row to be stuck
+#define HEALTH_NOISE_STEP 16     // a change this small is noise, not surface
+#define HEALTH_WINDOW 50000U     // TMR1 ticks per health window, 100ms
+#define HEALTH_FAULT_STEP 4      // fault_count added per window violated
+#define HEALTH_FAULT_MAX 64      // fault_count that fails the sensor, 1.6s
+
+static void add_sensor_fault(struct IRSensor *);
+
+void check_sensor_reading(struct IRSensor *sensor, short reading){
+    /*
+    Per-sample checks on a single sensor. Counts the run of identical
+    readings, and notes whether the last change was noise sized, for
+    check_pattern_health() to judge against the other sensors. A reading
+    below HEALTH_RANGE_MIN means it is open or shorted. Full scale is left
+    alone, a sensor over a dark line can sit there.
+    */
+    short step = reading - sensor->reading;
+    
+    if (step == 0){
+        if (sensor->stuck_count < HEALTH_STUCK_MAX){
+            ++sensor->stuck_count;
+        }
+    }
+    
+    else {
+        sensor->stuck_count = 0;
+        sensor->noisy = step <= HEALTH_NOISE_STEP && 
+                        step >= -HEALTH_NOISE_STEP;
+    }
+    
+    if (reading < HEALTH_RANGE_MIN){
+        sensor->violated = 1;
+    }
+    
+    sensor->reading = reading;
+}
+
+void check_pattern_health(struct IRSensor *first, char meas, char meas_last, 
+        unsigned long ticks){
+    /*
+    Checks every sensor's bit against its neighbours. The line is one
+    continuous strip, so a sensor reading clear between two that see the
+    line, or changing state while only a sensor beyond its neighbours sees
+    the line, is implausible. The line entering or leaving the array at an
+    edge is not. Faults are counted per HEALTH_WINDOW with any violation,
+    not per sample, so how long a sensor misbehaves decides, whatever the
+    scan rate; clean windows slowly pay off earlier ones.
+    
+    A run of HEALTH_STUCK_MAX identical readings is a violation only while
+    another sensor still shows noise. A sensor over a uniform surface can
+    hold steady too, so steady readings alone, or beside sensors that only
+    jump as the line passes, blame nobody. Full scale is never blamed.
+    */
+    struct IRSensor *sensor = first;
+    char noisy = 0;
+    
+    do {
+        noisy |= sensor->noisy && sensor->stuck_count < HEALTH_STUCK_MAX;
+        sensor = sensor->next_sensor;
+    } while (sensor != first);
+    
+    do {
+        char bit = 1 << sensor->index;
+        char neighbours = ((bit << 1) | (bit >> 1)) & ((1 << IR_SENSORS) - 1);
+        char beyond = ((1 << IR_SENSORS) - 1) & ~(neighbours | bit);
+        char inner = sensor->index != 0 && sensor->index != IR_SENSORS - 1;
+        char between = inner && (meas & neighbours) == neighbours && 
+                       !(meas & bit);
+        char lone_change = ((meas ^ meas_last) & bit) && 
+                           ((meas | meas_last) & neighbours) == 0 && 
+                           ((meas | meas_last) & beyond) != 0;
+        
+        char stuck = noisy && sensor->stuck_count >= HEALTH_STUCK_MAX &&
+                     sensor->reading != HEALTH_SATURATED;
+        
+        if (between || lone_change || stuck){
+            sensor->violated = 1;
+        }
+        
+        if (ticks - sensor->health_ticks >= HEALTH_WINDOW){
+            if (sensor->violated){
+                add_sensor_fault(sensor);
+            }
+            
+            else if (sensor->fault_count != 0){
+                --sensor->fault_count;
+            }
+            
+            sensor->violated = 0;
+            sensor->health_ticks = ticks;
+        }
+        
+        sensor = sensor->next_sensor;
+    } while (sensor != first);
+}
+
+void reset_sensor_health(struct IRSensor *first){
+    struct IRSensor *sensor = first;
+    
+    do {
+        sensor->stuck_count = 0;
+        sensor->noisy = 0;
+        sensor->fault_count = 0;
+        sensor->violated = 0;
+        sensor->failed = 0;
+        sensor = sensor->next_sensor;
+    } while (sensor != first);
+}
+
+char get_failed_sensors(struct IRSensor *first){
+    // Bit mask, by index, of the sensors excluded from the estimate
+    struct IRSensor *sensor = first;
+    char failed = 0;
+    
+    do {
+        if (sensor->failed){
+            failed |= 1 << sensor->index;
+        }
+        
+        sensor = sensor->next_sensor;
+    } while (sensor != first);
+    
+    return failed;
+}
+
+char mask_failed_sensors(char meas, char failed){
+    /*
+    Rebuilds the three sensor pattern without the failed sensors so the
+    normal controller keeps running on the healthy ones.
+    Center failed: both outer sensors set is the stop marker. Both clear
+        stays lost, a line under the center can't be told from no line, and
+        the lost timeout must still be able to stop the robot.
+    Outer failed: its bit reads clear, a line on that side still shows on
+        the center sensor as a slight turn.
+    Any more than one failure leaves too little to steer on, and the
+    pattern is reported as lost.
+    */
+    switch (failed){
+        case 0 :
+            break;
+        case 2 :        // center
+            meas &= 0b101;
+            
+            if (meas == 0b101){
+                meas = 0b111;
+            }
+            break;
+        case 1 :        // outer
+        case 4 :
+            meas &= ~failed;
+            break;
+        default :
+            meas = 0;
+            break;
+    }
+    
+    return meas;
+}
+
+static void add_sensor_fault(struct IRSensor *sensor){
+    if (sensor->fault_count < HEALTH_FAULT_MAX - HEALTH_FAULT_STEP){
+        sensor->fault_count += HEALTH_FAULT_STEP;
+    }
+    
+    else {
+        sensor->fault_count = HEALTH_FAULT_MAX;
+        sensor->failed = 1;
+    }
+}
@@ -45,7 +45,7 @@ void init_display(){
     CCPTMRS1bits.C6TSEL0 = 0;       // CCP6 -> TMR1
     PIR4bits.CCP6IF = 0;            // clear flag
     IPR4bits.CCP6IP = 0;            // low pri
-    PIE4bits.CCP6IE = 0;            // enable
+    PIE4bits.CCP6IE = 1;            // enable
 }
 
 
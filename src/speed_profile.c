@@ -0,0 +1,71 @@
+/*
+ * File:   speed_profile.c
+ * Author: Jack
+ *
+ * Created on December 28, 2020, 2:00 PM
+ */
+
+#include <speed_profile.h>
+#include <encoders.h>
+#include <docking.h>
+
+#define DUTY_MAX 100            // full PWM duty
+
+void init_speed_profile(struct SpeedProfile *profile, char enabled){
+    profile->enabled = enabled;
+    start_speed_profile(profile, 0, 0);
+}
+
+void start_speed_profile(struct SpeedProfile *profile, int count_right, 
+        int count_left){
+    // The route starts here, travel along the table is counted from now
+    profile->start_right = count_right;
+    profile->start_left = count_left;
+}
+
+unsigned short profile_speed(struct SpeedProfile *profile, int count_right, 
+        int count_left){
+    /*
+    Planned speed in mm/s at the current travel along the route. Past the
+    end of the table, or disabled, it is CRUISE_SPEED, so the pattern duties
+    are left as they are and docking starts from the speed it expects.
+    Each wheel's difference stays correct across count wrap up to 32767
+    counts, 9 m at COUNTS_PER_REV; the two are averaged in long, as their
+    sum in int would overflow past half that.
+    */
+    if (!profile->enabled){
+        return CRUISE_SPEED;
+    }
+    
+    int right = count_right - profile->start_right;
+    int left = count_left - profile->start_left;
+    long counts = ((long)right + left) / 2;
+    
+    if (counts < 0){
+        counts = 0;
+    }
+    
+    unsigned short entry = (unsigned short)(counts * WHEEL_TRAVEL_MM / 
+            ((long)COUNTS_PER_REV * PROFILE_STEP_MM));
+    
+    if (entry >= speed_table_length){
+        return CRUISE_SPEED;
+    }
+    
+    return speed_table[entry] * PROFILE_SPEED_UNIT;
+}
+
+signed char profile_duty(signed char duty, unsigned short speed){
+    // Pattern duty scaled from the cruise calibration to speed
+    int scaled = (int)((long)duty * speed / CRUISE_SPEED);
+    
+    if (scaled > DUTY_MAX){
+        return DUTY_MAX;
+    }
+    
+    if (scaled < -DUTY_MAX){
+        return -DUTY_MAX;
+    }
+    
+    return (signed char)scaled;
+}
@@ -0,0 +1,406 @@
+/*
+ * File:   telemetry_codec.c
+ * Author: Jack
+ *
+ * Created on December 21, 2020, 10:15 AM
+ */
+
+#include <telemetry_codec.h>
+#include <crc.h>
+
+// Decoder states
+#define DECODE_HUNT 0           // looking for a keyframe anywhere
+#define DECODE_HUNT_SYNC 1
+#define DECODE_KEY 2            // a keyframe is due next
+#define DECODE_KEY_SYNC 3
+#define DECODE_KEY_VALUES 4
+#define DECODE_KEY_CRC 5
+#define DECODE_DELTAS 6
+#define DECODE_CHECK 7
+
+// Parts of a Rice code
+#define RICE_UNARY 0            // quotient, ones ended by a zero
+#define RICE_REMAINDER 1        // low k bits
+#define RICE_RAW 2              // escaped, all 16 bits
+
+#define VARINT_SHIFT_MAX 14     // 16 bit values take at most 3 bytes
+#define RICE_ESCAPE 15          // quotients from here are sent raw
+#define RICE_K_MAX 15
+#define RICE_SUM_START 4        // code size assumed after a keyframe
+#define RICE_SUM_CAP 2047       // largest code counted, keeps sums in 16 bits
+#define RICE_WINDOW 16          // codes before the sums are halved
+
+static unsigned char put_varint(unsigned char *, unsigned short);
+static void put_bits(unsigned char *, unsigned short *, unsigned short,
+        unsigned char);
+static unsigned short zigzag(short);
+static short unzigzag(unsigned short);
+static unsigned char values_crc(const short *);
+static unsigned char values_check(const short *);
+static void reset_rice(struct TelemetryRice *);
+static unsigned char rice_k(const struct TelemetryRice *, unsigned char);
+static void update_rice(struct TelemetryRice *, unsigned char, unsigned short);
+static void start_channel(struct TelemetryDecoder *);
+static void finish_channel(struct TelemetryDecoder *);
+static char finish_record(struct TelemetryDecoder *);
+
+void reset_telemetry_encoder(struct TelemetryEncoder *enc){
+    // The next record will be a keyframe
+    enc->count = 0;
+}
+
+unsigned char encode_telemetry(struct TelemetryEncoder *enc,
+        const short *values, unsigned char *out){
+    /*
+    Writes one record to out and returns its length, at most
+    TELEMETRY_RECORD_MAX. Deltas wrap at 16 bits, so counters that roll
+    over still cost a few bits.
+    */
+    unsigned char length = 0;
+    
+    if (enc->count == 0){
+        out[length++] = TELEMETRY_SYNC_0;
+        out[length++] = TELEMETRY_SYNC_1;
+        
+        for (unsigned char ch = 0; ch < TELEMETRY_CHANNELS; ++ch){
+            length += put_varint(out + length, zigzag(values[ch]));
+            enc->step[ch] = 0;
+        }
+        
+        out[length++] = values_crc(values);
+        reset_rice(&enc->rice);
+    }
+    
+    else {
+        unsigned short position = 0;
+        
+        for (unsigned char ch = 0; ch < TELEMETRY_CHANNELS; ++ch){
+            short step = (short)(values[ch] - enc->last[ch]);
+            short delta = step;
+            
+            if (TELEMETRY_PREDICTED & (1 << ch)){
+                delta = (short)(step - enc->step[ch]);
+                enc->step[ch] = step;
+            }
+            
+            unsigned short code = zigzag(delta);
+            unsigned char k = rice_k(&enc->rice, ch);
+            unsigned short quotient = code >> k;
+            
+            if (quotient < RICE_ESCAPE){
+                put_bits(out, &position, 0xFFFF, (unsigned char)quotient);
+                put_bits(out, &position, 0, 1);
+                put_bits(out, &position, code, k);
+            }
+            
+            else {
+                put_bits(out, &position, 0xFFFF, RICE_ESCAPE);
+                put_bits(out, &position, code, 16);
+            }
+            
+            update_rice(&enc->rice, ch, code);
+        }
+        
+        // Unused bits of the last byte are left 0
+        length = (unsigned char)((position + 7) / 8);
+        out[length++] = values_check(values);
+    }
+    
+    for (unsigned char ch = 0; ch < TELEMETRY_CHANNELS; ++ch){
+        enc->last[ch] = values[ch];
+    }
+    
+    if (++enc->count == TELEMETRY_KEYFRAME){
+        enc->count = 0;
+    }
+    
+    return length;
+}
+
+void reset_telemetry_decoder(struct TelemetryDecoder *dec){
+    dec->state = DECODE_HUNT;
+    dec->errors = 0;
+}
+
+char decode_telemetry_byte(struct TelemetryDecoder *dec, unsigned char byte){
+    /*
+    Streaming decoder, fed one byte at a time. Returns 1 when the byte
+    completes a record, which is then in dec->values. Until the first good
+    keyframe, and again after a keyframe is missed or a delta record fails
+    its check, it hunts for the sync bytes and only trusts what it finds
+    once the CRC matches.
+    */
+    switch (dec->state){
+        case DECODE_HUNT:
+        case DECODE_KEY:
+            if (byte == TELEMETRY_SYNC_0){
+                dec->state = dec->state == DECODE_HUNT ? DECODE_HUNT_SYNC :
+                        DECODE_KEY_SYNC;
+            }
+            
+            else if (dec->state == DECODE_KEY){
+                ++dec->errors;
+                dec->state = DECODE_HUNT;
+            }
+            
+            return 0;
+        
+        case DECODE_HUNT_SYNC:
+        case DECODE_KEY_SYNC:
+            if (byte == TELEMETRY_SYNC_1){
+                dec->state = DECODE_KEY_VALUES;
+                dec->channel = 0;
+                dec->value = 0;
+                dec->shift = 0;
+            }
+            
+            else if (byte != TELEMETRY_SYNC_0){
+                if (dec->state == DECODE_KEY_SYNC){
+                    ++dec->errors;
+                }
+                
+                dec->state = DECODE_HUNT;
+            }
+            
+            return 0;
+        
+        case DECODE_KEY_CRC:
+            if (byte != values_crc(dec->pending)){
+                ++dec->errors;
+                dec->state = DECODE_HUNT;
+                return 0;
+            }
+            
+            for (unsigned char ch = 0; ch < TELEMETRY_CHANNELS; ++ch){
+                dec->values[ch] = dec->pending[ch];
+                dec->step[ch] = 0;
+            }
+            
+            reset_rice(&dec->rice);
+            dec->count = 0;
+            return finish_record(dec);
+        
+        case DECODE_DELTAS:
+            // Rice codes, high bit first; what is left after the last one
+            // is padding, which the encoder leaves 0
+            for (unsigned char bit = 0x80; bit != 0; bit >>= 1){
+                if (dec->phase == RICE_UNARY){
+                    if (!(byte & bit)){
+                        dec->value = dec->bits;
+                        dec->bits = dec->k;
+                        dec->phase = RICE_REMAINDER;
+                    }
+                    
+                    else if (++dec->bits == RICE_ESCAPE){
+                        dec->value = 0;
+                        dec->bits = 16;
+                        dec->phase = RICE_RAW;
+                        continue;
+                    }
+                    
+                    else {
+                        continue;
+                    }
+                }
+                
+                else {
+                    dec->value = (unsigned short)(dec->value << 1) |
+                            ((byte & bit) != 0);
+                    --dec->bits;
+                }
+                
+                if (dec->phase != RICE_UNARY && dec->bits == 0){
+                    finish_channel(dec);
+                    
+                    if (dec->channel == TELEMETRY_CHANNELS){
+                        dec->state = DECODE_CHECK;
+                        
+                        if (byte & (bit - 1)){
+                            ++dec->errors;
+                            dec->state = DECODE_HUNT;
+                        }
+                        
+                        break;
+                    }
+                }
+            }
+            
+            return 0;
+        
+        case DECODE_CHECK:
+            if (byte != values_check(dec->values)){
+                ++dec->errors;
+                dec->state = DECODE_HUNT;
+                return 0;
+            }
+            
+            return finish_record(dec);
+    }
+    
+    // DECODE_KEY_VALUES, one more varint byte
+    dec->value |= (unsigned short)(byte & 0x7F) << dec->shift;
+    
+    if (byte & 0x80){
+        dec->shift += 7;
+        
+        if (dec->shift > VARINT_SHIFT_MAX){
+            ++dec->errors;
+            dec->state = DECODE_HUNT;
+        }
+        
+        return 0;
+    }
+    
+    dec->pending[dec->channel] = unzigzag(dec->value);
+    dec->value = 0;
+    dec->shift = 0;
+    
+    if (++dec->channel == TELEMETRY_CHANNELS){
+        dec->state = DECODE_KEY_CRC;
+    }
+    
+    return 0;
+}
+
+static void start_channel(struct TelemetryDecoder *dec){
+    dec->phase = RICE_UNARY;
+    dec->bits = 0;
+    dec->k = rice_k(&dec->rice, dec->channel);
+}
+
+static void finish_channel(struct TelemetryDecoder *dec){
+    // A whole Rice code is in value, apply it and move to the next channel
+    unsigned char ch = dec->channel;
+    short delta = unzigzag(dec->value);
+    
+    update_rice(&dec->rice, ch, dec->value);
+    
+    if (TELEMETRY_PREDICTED & (1 << ch)){
+        delta = (short)(dec->step[ch] + delta);
+        dec->step[ch] = delta;
+    }
+    
+    dec->values[ch] = (short)(dec->values[ch] + delta);
+    ++dec->channel;
+    start_channel(dec);
+}
+
+static char finish_record(struct TelemetryDecoder *dec){
+    if (++dec->count == TELEMETRY_KEYFRAME){
+        dec->count = 0;
+        dec->state = DECODE_KEY;
+    }
+    
+    else {
+        dec->state = DECODE_DELTAS;
+        dec->channel = 0;
+        start_channel(dec);
+    }
+    
+    return 1;
+}
+
+static void reset_rice(struct TelemetryRice *rice){
+    // Both ends start over at every keyframe, so they pick the same k
+    for (unsigned char ch = 0; ch < TELEMETRY_CHANNELS; ++ch){
+        rice->sum[ch] = RICE_SUM_START;
+        rice->count[ch] = 1;
+    }
+}
+
+static unsigned char rice_k(const struct TelemetryRice *rice,
+        unsigned char ch){
+    // Smallest k with 2^k at least the mean recent code
+    unsigned char k = 0;
+    
+    while (k < RICE_K_MAX &&
+            ((unsigned short)rice->count[ch] << k) < rice->sum[ch]){
+        ++k;
+    }
+    
+    return k;
+}
+
+static void update_rice(struct TelemetryRice *rice, unsigned char ch,
+        unsigned short code){
+    rice->sum[ch] += code < RICE_SUM_CAP ? code : RICE_SUM_CAP;
+    
+    if (++rice->count[ch] == RICE_WINDOW){
+        rice->sum[ch] >>= 1;
+        rice->count[ch] >>= 1;
+    }
+}
+
+static void put_bits(unsigned char *out, unsigned short *position,
+        unsigned short value, unsigned char bits){
+    // Low bits of value, high first, from bit position on
+    while (bits > 0){
+        unsigned char mask = 0x80 >> (*position & 7);
+        unsigned char *byte = out + (*position >> 3);
+        
+        --bits;
+        
+        if ((*position & 7) == 0){
+            *byte = 0;
+        }
+        
+        if ((value >> bits) & 1){
+            *byte |= mask;
+        }
+        
+        ++*position;
+    }
+}
+
+static unsigned char put_varint(unsigned char *out, unsigned short value){
+    // 7 bits per byte, low first, top bit set while more follow
+    unsigned char length = 0;
+    
+    while (value >= 0x80){
+        out[length++] = (unsigned char)(value | 0x80);
+        value >>= 7;
+    }
+    
+    out[length++] = (unsigned char)value;
+    return length;
+}
+
+static unsigned short zigzag(short value){
+    // Small magnitudes of either sign map to small codes: 0, -1, 1, -2, ...
+    return (unsigned short)((unsigned short)value << 1) ^
+            (value < 0 ? 0xFFFF : 0);
+}
+
+static short unzigzag(unsigned short code){
+    return (short)((code >> 1) ^ (code & 1 ? 0xFFFF : 0));
+}
+
+static unsigned char values_crc(const short *values){
+    // CRC of the values as the PIC stores them, little endian
+    unsigned char bytes[2 * TELEMETRY_CHANNELS];
+    
+    for (unsigned char ch = 0; ch < TELEMETRY_CHANNELS; ++ch){
+        bytes[2 * ch] = (unsigned char)values[ch];
+        bytes[2 * ch + 1] = (unsigned char)((unsigned short)values[ch] >> 8);
+    }
+    
+    return crc8(bytes, sizeof(bytes));
+}
+
+static unsigned char values_check(const short *values){
+    /*
+    Fletcher style sum of the values, little endian. Cheaper than the CRC
+    on the PIC, and as likely to catch the garbage a lost byte decodes to.
+    */
+    unsigned char sum = 0;
+    unsigned char check = 0;
+    
+    for (unsigned char ch = 0; ch < TELEMETRY_CHANNELS; ++ch){
+        sum += (unsigned char)values[ch];
+        check += sum;
+        sum += (unsigned char)((unsigned short)values[ch] >> 8);
+        check += sum;
+    }
+    
+    return check;
+}
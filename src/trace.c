@@ -0,0 +1,43 @@
+/*
+ * File:   trace.c
+ * Author: Jack
+ *
+ * Created on December 20, 2020, 2:40 PM
+ */
+
+#include <xc.h>
+#include <stdio.h>
+#include <trace.h>
+
+#if TRACE_ENABLE
+
+struct TraceRecord trace_buffer[TRACE_RECORDS];
+unsigned char trace_head = 0;
+char trace_paused = 0;
+
+void dump_trace(){
+    /*
+    Prints the buffer oldest first as "T" lines of four hex bytes in record
+    order. Recording is paused for the dump so the buffer holds still.
+    Unwritten records have type 0 and are skipped.
+    */
+    unsigned char index = trace_head;
+    
+    trace_paused = 1;
+    
+    for (unsigned short i = 0; i < TRACE_RECORDS; ++i){
+        struct TraceRecord *record = &trace_buffer[index];
+        
+        if (record->type != 0){
+            printf("T %02X%02X%02X%02X\r\n", record->type, record->id,
+                    record->time_low, record->time_high);
+        }
+        
+        index = (index + 1) & (TRACE_RECORDS - 1);
+    }
+    
+    printf("END\r\n");
+    trace_paused = 0;
+}
+
+#endif
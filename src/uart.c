@@ -0,0 +1,57 @@
+/*
+ * File:   uart.c
+ * Author: Jack
+ *
+ * Created on December 9, 2020, 6:20 PM
+ */
+
+#include <xc.h>
+#include <pic18f87k22.h>
+#include <uart.h>
+
+// Port C
+#define TX_T TRISC6
+#define RX_T TRISC7
+
+#define BAUD_DIVISOR 34     // 16MHz / (4 * (34 + 1)) = 114286 baud, 0.8%
+
+void init_UART(){
+    TRISCbits.TX_T = 0;
+    TRISCbits.RX_T = 1;
+    
+    BAUDCON1bits.BRG16 = 1;     // 16 bit baud rate generator
+    TXSTA1 = 0b00100100;        // 8 bit, transmit enabled, high speed
+    RCSTA1 = 0b10010000;        // serial port enabled, continuous receive
+    SPBRGH1 = (char)((BAUD_DIVISOR >> 8) & 0x00FF);
+    SPBRG1 = (char)(BAUD_DIVISOR & 0x00FF);
+    
+    PIE1bits.TX1IE = 0;         // polled, no interrupts
+    PIE1bits.RC1IE = 0;
+}
+
+void putch(char c){
+    /*
+    Blocking single byte transmit. Also the character sink XC8's printf
+    uses, so reports can be written with printf.
+    */
+    while (!TXSTA1bits.TRMT);
+    TXREG1 = c;
+}
+
+char uart_read(char *c){
+    /*
+    Non-blocking receive. Returns 1 and writes the byte to c if one was
+    waiting, 0 otherwise. Overruns are cleared by restarting the receiver.
+    */
+    if (RCSTA1bits.OERR){
+        RCSTA1bits.CREN = 0;
+        RCSTA1bits.CREN = 1;
+    }
+    
+    if (!PIR1bits.RC1IF){
+        return 0;
+    }
+    
+    *c = RCREG1;
+    return 1;
+}
@@ -0,0 +1,49 @@
+/*
+ * File:   warm_restart.c
+ * Author: Jack
+ *
+ * Created on December 12, 2020, 10:05 AM
+ */
+
+#include <xc.h>
+#include <pic18f87k22.h>
+#include <warm_restart.h>
+#include <delivery_log.h>
+#include <crc.h>
+
+__persistent struct WarmState warm_state;
+
+static char warm_state_crc(void);
+
+void save_warm_state(char go_flag, int count_right, int count_left){
+    warm_state.go_flag = go_flag;
+    warm_state.count_right = count_right;
+    warm_state.count_left = count_left;
+    warm_state.crc = warm_state_crc();
+}
+
+char check_warm_restart(){
+    /*
+    Returns 1 if this reset should resume from warm_state: the RAM was not
+    lost to a power-on or brown-out reset and its CRC still matches. Must
+    be called before clear_reset_flags().
+    */
+    if (!RCONbits.POR || !RCONbits.BOR){
+        return 0;
+    }
+    
+    return warm_state.crc == warm_state_crc();
+}
+
+void clear_reset_flags(){
+    // POR and BOR only clear in hardware, set them to spot the next reset
+    RCONbits.POR = 1;
+    RCONbits.BOR = 1;
+}
+
+static char warm_state_crc(){
+    unsigned char crc = crc8((const unsigned char *)&warm_state, 
+            sizeof(warm_state) - 1);
+    
+    return delivery_stats_crc(crc);
+}
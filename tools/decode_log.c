@@ -0,0 +1,91 @@
+/*
+ * File:   decode_log.c
+ * Author: Jack
+ *
+ * Created on December 14, 2020, 8:20 PM
+ *
+ * Host tool. Decodes the delivery log dumped by the robot when it receives
+ * 'D' on the UART (see delivery_log.h) into CSV, followed by a summary.
+ *
+ * Build: cc -Iheaders -o decode_log tools/decode_log.c src/crc.c
+ * Usage: decode_log < dump.txt > deliveries.csv
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <crc.h>
+
+#define LOG_RECORD_SIZE 16
+
+static const char *reasons[] = {"completed", "line_lost", "dock_failed"};
+
+static unsigned short read_u16(const unsigned char *data){
+    return data[0] | (data[1] << 8);    // PIC18 is little endian
+}
+
+int main(void){
+    char line[128];
+    unsigned char data[LOG_RECORD_SIZE];
+    unsigned long deliveries = 0;
+    unsigned long completed = 0;
+    unsigned long lost_events = 0;
+    unsigned long total_time = 0;
+    unsigned long total_distance = 0;
+    unsigned long bad = 0;
+    
+    printf("sequence,start_s,end_s,duration_s,distance_cm,lost_events,"
+           "recovery_s,pause_s,battery_min_v,abort_reason\n");
+    
+    while (fgets(line, sizeof(line), stdin)){
+        if (strncmp(line, "L ", 2) != 0){
+            continue;
+        }
+        
+        int b;
+        
+        for (b = 0; b < LOG_RECORD_SIZE; ++b){
+            unsigned int byte;
+            
+            if (sscanf(line + 2 + 2 * b, "%2x", &byte) != 1){
+                break;
+            }
+            
+            data[b] = (unsigned char)byte;
+        }
+        
+        if (b != LOG_RECORD_SIZE || 
+                crc8(data, LOG_RECORD_SIZE - 1) != data[LOG_RECORD_SIZE - 1]){
+            ++bad;
+            continue;
+        }
+        
+        unsigned short start = read_u16(data + 2);
+        unsigned short end = read_u16(data + 4);
+        unsigned short duration = end - start;
+        unsigned char reason = data[14];
+        
+        printf("%u,%u,%u,%u,%u,%u,%.1f,%.1f,%.2f,%s\n",
+                read_u16(data), start, end, duration, read_u16(data + 6),
+                data[8], read_u16(data + 9) / 10.0, read_u16(data + 11) / 10.0,
+                data[13] * 0.05,
+                reason < sizeof(reasons) / sizeof(reasons[0]) ? 
+                        reasons[reason] : "unknown");
+        
+        ++deliveries;
+        completed += reason == 0;
+        lost_events += data[8];
+        total_time += duration;
+        total_distance += read_u16(data + 6);
+    }
+    
+    fprintf(stderr, "%lu deliveries, %lu completed, %lu lost events, "
+            "%lu bad records\n", deliveries, completed, lost_events, bad);
+    
+    if (total_time != 0){
+        fprintf(stderr, "%.1f deliveries/hour, %.1f cm/s average\n",
+                deliveries * 3600.0 / total_time, 
+                (double)total_distance / total_time);
+    }
+    
+    return 0;
+}
@@ -0,0 +1,62 @@
+/*
+ * File:   decode_telemetry.c
+ * Author: Jack
+ *
+ * Created on December 21, 2020, 2:00 PM
+ *
+ * Host tool. Decodes the compressed telemetry stream the robot sends after
+ * it receives 'S' on the UART (see telemetry_codec.h) into CSV. The stream
+ * is read as it arrives, so it can sit on the end of a pipe from the port.
+ *
+ * Build: cc -Iheaders -o decode_telemetry tools/decode_telemetry.c
+ *            src/telemetry_codec.c src/crc.c
+ * Usage: decode_telemetry < /dev/ttyUSB0 > telemetry.csv
+ */
+
+#include <stdio.h>
+#include <telemetry_codec.h>
+
+#define TIME_TICKS 512          // TMR1 ticks per time channel count
+#define TMR1_HZ 500000UL
+
+int main(void){
+    struct TelemetryDecoder decoder;
+    unsigned long records = 0;
+    unsigned long bytes = 0;
+    unsigned long time = 0;
+    unsigned short time_last = 0;
+    int c;
+    
+    reset_telemetry_decoder(&decoder);
+    printf("time_s,ir_1,ir_2,ir_3,count_right,count_left,speed_mm_s,"
+           "pattern,failed\n");
+    
+    while ((c = getchar()) != EOF){
+        ++bytes;
+        
+        if (!decode_telemetry_byte(&decoder, (unsigned char)c)){
+            continue;
+        }
+        
+        const short *v = decoder.values;
+        
+        // The time channel wraps every 67s, unwrap it into a running total
+        if (records != 0){
+            time += (unsigned short)(v[0] - time_last);
+        }
+        
+        time_last = (unsigned short)v[0];
+        ++records;
+        
+        printf("%.4f,%d,%d,%d,%d,%d,%d,%d,%d\n", 
+                (double)time * TIME_TICKS / TMR1_HZ, v[1], v[2], v[3], 
+                v[4], v[5], v[6], v[7] & 0x0F, (v[7] >> 4) & 0x0F);
+        fflush(stdout);
+    }
+    
+    fprintf(stderr, "%lu records, %lu bytes, %.2f bytes per record, "
+            "%lu resyncs\n", records, bytes, 
+            records ? (double)bytes / records : 0.0, decoder.errors);
+    
+    return 0;
+}
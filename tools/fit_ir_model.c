@@ -0,0 +1,328 @@
+/*
+ * File:   fit_ir_model.c
+ * Author: Jack
+ *
+ * Created on December 26, 2020, 10:30 AM
+ *
+ * Host tool. Fits the simulator's IR sensor model (sim.h) to readings
+ * recorded while the sensors pass over a line of known width, and writes
+ * the model file sim_load_ir_models() reads. Each sensor's reading across
+ * the line is taken as a Gaussian spot seen through a box the width of the
+ * line,
+ *
+ *     adc = offset + gain * spot(lateral - center) + pwm_gain * |duty| + n
+ *
+ * where n is AR(1) noise. Spot width and center come from a grid search,
+ * coarse then fine, with offset, gain and pwm_gain solved by least squares
+ * at every point. The noise is what is left over, its rms and lag 1
+ * correlation go in the model and lags 1 to 4 are printed to stderr, to
+ * check the AR(1) shape fits.
+ *
+ * Input is CSV in time order, "sensor,lateral_mm,adc[,duty]", sensor 0 to
+ * 2 for IR_1 to IR_3, lateral from any fixed point and duty the mean motor
+ * duty in percent. With -t the input is decode_telemetry output recorded
+ * while driving straight across the line, lateral is then the travel from
+ * the encoders and duty follows from the speed.
+ *
+ * Build: cc -O2 -Iheaders -Isim -o fit_ir_model tools/fit_ir_model.c -lm
+ * Usage: fit_ir_model [-t] line_mm < samples.csv > ir_models.txt
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <encoders.h>
+#include <sim.h>
+
+#define MIN_SAMPLES 32          // fewer than this and a sensor is skipped
+#define COARSE_STEP 0.5f        // mm, grid of the first pass
+#define FINE_STEP 0.02f         // mm, grid of the second pass
+#define SPOT_MAX 30.0f          // mm, widest spot tried
+#define NOISE_LAGS 4            // autocorrelation lags reported
+
+struct Samples
+{
+    int count;
+    int size;
+    float *lateral;
+    float *adc;
+    float *duty;
+};
+
+struct Fit
+{
+    float spot;
+    float center;
+    double offset;
+    double gain;
+    double pwm_gain;
+    double error;               // sum of squared residuals
+};
+
+static float line_mm;
+
+static void add_sample(struct Samples *samples, float lateral, float adc,
+        float duty){
+    if (samples->count == samples->size){
+        samples->size = samples->size ? samples->size * 2 : 1024;
+        samples->lateral = realloc(samples->lateral,
+                samples->size * sizeof(float));
+        samples->adc = realloc(samples->adc, samples->size * sizeof(float));
+        samples->duty = realloc(samples->duty, samples->size * sizeof(float));
+        
+        if (!samples->lateral || !samples->adc || !samples->duty){
+            fprintf(stderr, "out of memory\n");
+            exit(1);
+        }
+    }
+    
+    samples->lateral[samples->count] = lateral;
+    samples->adc[samples->count] = adc;
+    samples->duty[samples->count] = duty;
+    ++samples->count;
+}
+
+static float spot(float x, float sigma){
+    // Fraction of a Gaussian spot of sigma mm that falls on the line
+    float scale = 1.0f / (1.4142136f * sigma);
+    
+    return 0.5f * (erff((x + line_mm / 2) * scale) -
+                   erff((x - line_mm / 2) * scale));
+}
+
+static void try_fit(const struct Samples *samples, float sigma, float center,
+        struct Fit *best){
+    /*
+    Least squares for offset, gain and pwm_gain with the spot fixed, through
+    the 3x3 normal equations. When the duty never changes its column is
+    dropped, as it cannot be told apart from the offset.
+    */
+    double s_1 = 0, s_p = 0, s_d = 0, s_pp = 0, s_pd = 0, s_dd = 0;
+    double s_a = 0, s_pa = 0, s_da = 0, s_aa = 0;
+    
+    for (int i = 0; i < samples->count; ++i){
+        double p = spot(samples->lateral[i] - center, sigma);
+        double d = fabsf(samples->duty[i]);
+        double a = samples->adc[i];
+        
+        s_1 += 1;
+        s_p += p;
+        s_d += d;
+        s_pp += p * p;
+        s_pd += p * d;
+        s_dd += d * d;
+        s_a += a;
+        s_pa += p * a;
+        s_da += d * a;
+        s_aa += a * a;
+    }
+    
+    double det = s_1 * (s_pp * s_dd - s_pd * s_pd) -
+                 s_p * (s_p * s_dd - s_pd * s_d) +
+                 s_d * (s_p * s_pd - s_pp * s_d);
+    double offset, gain, pwm_gain = 0;
+    
+    if (fabs(det) > 1e-9 * s_1 * s_1 * s_1){
+        offset = (s_a * (s_pp * s_dd - s_pd * s_pd) -
+                  s_p * (s_pa * s_dd - s_pd * s_da) +
+                  s_d * (s_pa * s_pd - s_pp * s_da)) / det;
+        gain = (s_1 * (s_pa * s_dd - s_pd * s_da) -
+                s_a * (s_p * s_dd - s_pd * s_d) +
+                s_d * (s_p * s_da - s_pa * s_d)) / det;
+        pwm_gain = (s_1 * (s_pp * s_da - s_pa * s_pd) -
+                    s_p * (s_p * s_da - s_pa * s_d) +
+                    s_a * (s_p * s_pd - s_pp * s_d)) / det;
+    }
+    else {
+        det = s_1 * s_pp - s_p * s_p;
+        
+        if (fabs(det) < 1e-12){
+            return;
+        }
+        
+        gain = (s_1 * s_pa - s_p * s_a) / det;
+        offset = (s_a - gain * s_p) / s_1;
+    }
+    
+    // Sum of squared residuals from the sums, no second pass over the data
+    double error = s_aa + offset * offset * s_1 + gain * gain * s_pp +
+            pwm_gain * pwm_gain * s_dd - 2 * offset * s_a - 2 * gain * s_pa -
+            2 * pwm_gain * s_da + 2 * offset * gain * s_p +
+            2 * offset * pwm_gain * s_d + 2 * gain * pwm_gain * s_pd;
+    
+    if (error < best->error){
+        best->spot = sigma;
+        best->center = center;
+        best->offset = offset;
+        best->gain = gain;
+        best->pwm_gain = pwm_gain;
+        best->error = error;
+    }
+}
+
+static void search(const struct Samples *samples, float spot_low,
+        float spot_high, float center_low, float center_high, float step,
+        struct Fit *best){
+    for (float sigma = spot_low; sigma <= spot_high; sigma += step){
+        for (float center = center_low; center <= center_high;
+                center += step){
+            try_fit(samples, sigma, center, best);
+        }
+    }
+}
+
+static float centroid(const struct Samples *samples){
+    // Where the readings rise furthest above the floor, to start the search
+    float floor = samples->adc[0];
+    double sum = 0, moment = 0;
+    
+    for (int i = 1; i < samples->count; ++i){
+        floor = fminf(floor, samples->adc[i]);
+    }
+    
+    for (int i = 0; i < samples->count; ++i){
+        sum += samples->adc[i] - floor;
+        moment += (samples->adc[i] - floor) * samples->lateral[i];
+    }
+    
+    return sum > 0 ? (float)(moment / sum) : samples->lateral[0];
+}
+
+static void fit_sensor(int sensor, const struct Samples *samples){
+    struct Fit best = {0, 0, 0, 0, 0, HUGE_VAL};
+    float start = centroid(samples);
+    
+    search(samples, COARSE_STEP, SPOT_MAX, start - line_mm, start + line_mm,
+            COARSE_STEP, &best);
+    search(samples, fmaxf(best.spot - COARSE_STEP, FINE_STEP),
+            best.spot + COARSE_STEP, best.center - COARSE_STEP,
+            best.center + COARSE_STEP, FINE_STEP, &best);
+    
+    // Noise is whatever the model leaves, in time order
+    double *residual = malloc(samples->count * sizeof(double));
+    double lag[NOISE_LAGS + 1] = {0};
+    
+    if (residual == 0){
+        fprintf(stderr, "out of memory\n");
+        exit(1);
+    }
+    
+    for (int i = 0; i < samples->count; ++i){
+        residual[i] = samples->adc[i] - best.offset - best.gain *
+                spot(samples->lateral[i] - best.center, best.spot) -
+                best.pwm_gain * fabsf(samples->duty[i]);
+    }
+    
+    for (int k = 0; k <= NOISE_LAGS; ++k){
+        for (int i = k; i < samples->count; ++i){
+            lag[k] += residual[i] * residual[i - k];
+        }
+    }
+    
+    free(residual);
+    
+    float noise = (float)sqrt(lag[0] / samples->count);
+    float noise_ar = lag[0] > 0 ? (float)(lag[1] / lag[0]) : 0;
+    
+    noise_ar = fminf(fmaxf(noise_ar, 0), 0.99f);
+    
+    fprintf(stderr, "sensor %d: %d samples, center %.2f mm, noise "
+            "correlation", sensor, samples->count, best.center);
+    
+    for (int k = 1; k <= NOISE_LAGS; ++k){
+        fprintf(stderr, " %.3f", lag[0] > 0 ? lag[k] / lag[0] : 0);
+    }
+    
+    fprintf(stderr, " (AR(1) gives %.3f %.3f %.3f %.3f)\n", noise_ar,
+            powf(noise_ar, 2), powf(noise_ar, 3), powf(noise_ar, 4));
+    printf("sensor %d offset %.1f gain %.1f spot_mm %.2f noise %.2f "
+           "noise_ar %.3f pwm_gain %.3f\n", sensor, best.offset, best.gain,
+           best.spot, noise, noise_ar, best.pwm_gain);
+}
+
+static void read_samples(FILE *file, struct Samples *samples){
+    char text[256];
+    
+    while (fgets(text, sizeof(text), file)){
+        int sensor;
+        float lateral, adc, duty = 0;
+        
+        if (sscanf(text, "%d,%f,%f,%f", &sensor, &lateral, &adc, &duty) < 3 ||
+                sensor < 0 || sensor >= SIM_SENSORS){
+            continue;
+        }
+        
+        add_sample(&samples[sensor], lateral, adc, duty);
+    }
+}
+
+static void read_telemetry(FILE *file, struct Samples *samples){
+    /*
+    decode_telemetry rows, the sensors all cross the line together when
+    driven straight across it, so each row gives one sample per sensor at
+    the mean travel of the wheels.
+    */
+    char text[256];
+    const float mm_per_count = (float)WHEEL_TRAVEL_MM / COUNTS_PER_REV;
+    
+    while (fgets(text, sizeof(text), file)){
+        float time;
+        int adc[SIM_SENSORS], count_right, count_left, speed;
+        
+        if (sscanf(text, "%f,%d,%d,%d,%d,%d,%d", &time, &adc[0], &adc[1],
+                &adc[2], &count_right, &count_left, &speed) != 7){
+            continue;
+        }
+        
+        float travel = (count_right + count_left) * 0.5f * mm_per_count;
+        float duty = (float)speed * CRUISE_DUTY / CRUISE_SPEED;
+        
+        for (int sensor = 0; sensor < SIM_SENSORS; ++sensor){
+            add_sample(&samples[sensor], travel, adc[sensor], duty);
+        }
+    }
+}
+
+int main(int argc, char *argv[]){
+    struct Samples samples[SIM_SENSORS];
+    int telemetry = argc > 1 && strcmp(argv[1], "-t") == 0;
+    int fitted = 0;
+    
+    line_mm = argc > 1 + telemetry ? (float)atof(argv[1 + telemetry]) : 0;
+    
+    if (line_mm <= 0){
+        fprintf(stderr, "usage: fit_ir_model [-t] line_mm < samples.csv\n");
+        return 1;
+    }
+    
+    memset(samples, 0, sizeof(samples));
+    
+    if (telemetry){
+        read_telemetry(stdin, samples);
+    }
+    else {
+        read_samples(stdin, samples);
+    }
+    
+    printf("# fit_ir_model, line %.1f mm\n", line_mm);
+    
+    for (int sensor = 0; sensor < SIM_SENSORS; ++sensor){
+        if (samples[sensor].count < MIN_SAMPLES){
+            fprintf(stderr, "sensor %d: %d samples, skipped\n", sensor,
+                    samples[sensor].count);
+            continue;
+        }
+        
+        fit_sensor(sensor, &samples[sensor]);
+        ++fitted;
+    }
+    
+    for (int sensor = 0; sensor < SIM_SENSORS; ++sensor){
+        free(samples[sensor].lateral);
+        free(samples[sensor].adc);
+        free(samples[sensor].duty);
+    }
+    
+    return fitted == 0;
+}
@@ -0,0 +1,163 @@
+/*
+ * File:   freq_response.c
+ * Author: Jack
+ *
+ * Created on December 29, 2020, 3:00 PM
+ *
+ * Host tool. Turns the steering frequency response report the robot sends
+ * after it receives 'F' on the UART (see freq_response.h) into gain and
+ * phase at each frequency, as CSV, and prints the crossover, phase margin,
+ * gain margin and closed loop bandwidth to stderr.
+ *
+ * The perturbation d is added to the controller's steering c, so the
+ * steering applied is u = c + d. The plant, steering to line offset, is
+ * P = Y / U and the loop gain is L = -C / U, since the controller closes
+ * the loop with negative feedback. The pattern controller is a relay more
+ * than a gain, so L is its describing function at FREQ_AMPLITUDE and will
+ * move with the amplitude.
+ *
+ * Build: cc -Iheaders -o freq_response tools/freq_response.c -lm
+ * Usage: freq_response < report.txt > response.csv
+ */
+
+#include <stdio.h>
+#include <math.h>
+#include <freq_response.h>
+#include <line_offset.h>
+
+#define POINTS_MAX 64
+
+struct Response
+{
+    double hz;
+    double plant_db;            // line offset in sensor spacings per duty
+    double plant_deg;
+    double loop_db;
+    double loop_deg;
+    double closed_db;           // L / (1 + L), steering command to steering
+};
+
+static double unwrap(double deg, double last){
+    // Nearest equivalent of deg to last, phase runs on across frequencies
+    while (deg - last > 180){
+        deg -= 360;
+    }
+    
+    while (deg - last < -180){
+        deg += 360;
+    }
+    
+    return deg;
+}
+
+static double crossing(const struct Response *a, const struct Response *b,
+        double va, double vb, double level){
+    // Frequency where v crosses level between two points, log interpolated
+    double t = (level - va) / (vb - va);
+    
+    return exp(log(a->hz) + t * (log(b->hz) - log(a->hz)));
+}
+
+int main(void){
+    struct Response response[POINTS_MAX];
+    char line[160];
+    int points = 0;
+    
+    printf("hz,plant_db,plant_deg,loop_db,loop_deg,closed_db\n");
+    
+    while (fgets(line, sizeof(line), stdin) && points < POINTS_MAX){
+        unsigned centihz, samples;
+        long u_sin, u_cos, c_sin, c_cos, y_sin, y_cos;
+        
+        if (sscanf(line, "F %u %u %ld %ld %ld %ld %ld %ld", &centihz,
+                &samples, &u_sin, &u_cos, &c_sin, &c_cos, &y_sin,
+                &y_cos) != 8 || samples == 0){
+            continue;
+        }
+        
+        // Each sum is a signal's phasor against the same reference
+        double u_power = u_sin * (double)u_sin + u_cos * (double)u_cos;
+        double p_re = (y_sin * (double)u_sin + y_cos * (double)u_cos) /
+                      u_power / LINE_OFFSET_SCALE;
+        double p_im = (y_cos * (double)u_sin - y_sin * (double)u_cos) /
+                      u_power / LINE_OFFSET_SCALE;
+        double l_re = -(c_sin * (double)u_sin + c_cos * (double)u_cos) /
+                      u_power;
+        double l_im = -(c_cos * (double)u_sin - c_sin * (double)u_cos) /
+                      u_power;
+        double t_re = 1 + l_re;
+        double closed = hypot(l_re, l_im) / hypot(t_re, l_im);
+        struct Response *r = &response[points];
+        
+        r->hz = centihz / 100.0;
+        r->plant_db = 20 * log10(hypot(p_re, p_im));
+        r->plant_deg = atan2(p_im, p_re) * 180 / M_PI;
+        r->loop_db = 20 * log10(hypot(l_re, l_im));
+        r->loop_deg = atan2(l_im, l_re) * 180 / M_PI;
+        r->closed_db = 20 * log10(closed);
+        
+        if (points > 0){
+            r->plant_deg = unwrap(r->plant_deg, r[-1].plant_deg);
+            r->loop_deg = unwrap(r->loop_deg, r[-1].loop_deg);
+        }
+        
+        else if (r->loop_deg > 0){
+            // start in (-360, 0], where a lagging loop sits
+            r->loop_deg -= 360;
+        }
+        
+        printf("%.2f,%.2f,%.1f,%.2f,%.1f,%.2f\n", r->hz, r->plant_db,
+                r->plant_deg, r->loop_db, r->loop_deg, r->closed_db);
+        ++points;
+    }
+    
+    if (points == 0){
+        fprintf(stderr, "no F lines\n");
+        return 1;
+    }
+    
+    char found_crossover = 0;
+    char found_gain_margin = 0;
+    char found_bandwidth = 0;
+    
+    for (int i = 1; i < points; ++i){
+        const struct Response *a = &response[i - 1];
+        const struct Response *b = &response[i];
+        
+        if (!found_crossover && a->loop_db >= 0 && b->loop_db < 0){
+            double hz = crossing(a, b, a->loop_db, b->loop_db, 0);
+            double deg = a->loop_deg + (b->loop_deg - a->loop_deg) *
+                    log(hz / a->hz) / log(b->hz / a->hz);
+            
+            fprintf(stderr, "crossover        %.2f Hz\n", hz);
+            fprintf(stderr, "phase margin     %.0f deg\n", 180 + deg);
+            found_crossover = 1;
+        }
+        
+        if (!found_gain_margin && a->loop_deg > -180 && b->loop_deg <= -180){
+            double hz = crossing(a, b, a->loop_deg, b->loop_deg, -180);
+            double db = a->loop_db + (b->loop_db - a->loop_db) *
+                    log(hz / a->hz) / log(b->hz / a->hz);
+            
+            fprintf(stderr, "phase crossover  %.2f Hz\n", hz);
+            fprintf(stderr, "gain margin      %.1f dB\n", -db);
+            found_gain_margin = 1;
+        }
+        
+        if (!found_bandwidth && a->closed_db >= -3 && b->closed_db < -3){
+            fprintf(stderr, "bandwidth        %.2f Hz\n",
+                    crossing(a, b, a->closed_db, b->closed_db, -3));
+            found_bandwidth = 1;
+        }
+    }
+    
+    if (!found_crossover){
+        fprintf(stderr, "loop gain does not cross 0 dB in the sweep\n");
+    }
+    
+    if (!found_gain_margin){
+        fprintf(stderr, "loop phase does not reach -180 deg in the sweep\n");
+    }
+    
+    return 0;
+}
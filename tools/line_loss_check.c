@@ -0,0 +1,94 @@
+/*
+ * File:   line_loss_check.c
+ * Author: Jack
+ *
+ * Created on January 2, 2021, 10:00 AM
+ *
+ * Host tool. Runs the line loss predictor over the same drift toward the
+ * edge of the array on both sides of center and checks that each is
+ * forecast, at the same time, and that a drift back toward center is not.
+ * Also checks that line_offset() puts the line under either outer sensor
+ * on that sensor's side, the offset the predictor is fed.
+ * XC8 treats plain char as unsigned, so build with -funsigned-char to
+ * catch signed values kept in plain char the way the PIC would.
+ *
+ * Build: cc -funsigned-char -Iheaders -o line_loss_check
+ *            tools/line_loss_check.c src/line_loss.c src/line_offset.c
+ * Usage: line_loss_check
+ */
+
+#include <stdio.h>
+#include <line_loss.h>
+#include <line_offset.h>
+
+#define STEP_MS 20              // control timestep
+#define STEPS 20
+#define DRIFT 4                 // offset counts outward per step
+#define CUTOFF 3500             // same as main.c
+#define HORIZON_MS 150          // same as main.c
+
+static struct IRSensor ring[IR_SENSORS];
+
+static void init_ring(void){
+    // Left to right, positions as init_robot() sets them
+    for (int i = 0; i < IR_SENSORS; ++i){
+        ring[i].index = (char)i;
+        ring[i].position = (signed char)(1 - i);
+        ring[i].reading = 4000;
+        ring[i].failed = 0;
+        ring[i].next_sensor = &ring[(i + 1) % IR_SENSORS];
+    }
+}
+
+static unsigned short drift(int side, int outward, char *imminent){
+    // Forecast and imminent flag after STEPS steps toward side, outward or
+    // back in
+    struct LossPredictor predictor;
+    short start = outward ? LINE_OFFSET_SCALE / 4 : LINE_OFFSET_SCALE * 3 / 4;
+    
+    init_ring();
+    init_loss_predictor(&predictor, 1, HORIZON_MS, CUTOFF);
+    *imminent = 0;
+    
+    for (int step = 0; step < STEPS; ++step){
+        short offset = start + (outward ? step : -step) * DRIFT;
+        
+        *imminent = update_loss_predictor(&predictor, ring, 
+                (short)(side * offset), STEP_MS);
+    }
+    
+    return predictor.forecast_ms;
+}
+
+static short offset_under(int sensor){
+    // Offset with only the given sensor over the line
+    init_ring();
+    
+    for (int i = 0; i < IR_SENSORS; ++i){
+        ring[i].reading = i == sensor ? 4000 : 600;
+    }
+    
+    return line_offset(ring);
+}
+
+int main(void){
+    char imminent_left;
+    char imminent_right;
+    char imminent_in;
+    unsigned short left = drift(1, 1, &imminent_left);
+    unsigned short right = drift(-1, 1, &imminent_right);
+    unsigned short in = drift(-1, 0, &imminent_in);
+    short offset_left = offset_under(0);
+    short offset_right = offset_under(IR_SENSORS - 1);
+    int ok = offset_left == LINE_OFFSET_SCALE && 
+             offset_right == -LINE_OFFSET_SCALE && left == right && left != 0xFFFF && imminent_left && 
+             imminent_right && in == 0xFFFF && !imminent_in;
+    
+    printf("offset under left %d, under right %d\n", offset_left, 
+            offset_right);
+    printf("left %u ms, right %u ms, right drifting in %u ms\n", left, right,
+            in);
+    printf("%s\n", ok ? "ok" : "FAILED");
+    
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,210 @@
+/*
+ * File:   plan_speed.c
+ * Author: Jack
+ *
+ * Created on December 28, 2020, 10:00 AM
+ *
+ * Host tool. Plans the minimum time speed profile along a known route and
+ * writes it as the distance indexed table the firmware follows with
+ * SPEED_PROFILE (speed_profile.h). The route is read as straights and arcs,
+ * one per line:
+ *
+ *     straight LENGTH_MM
+ *     arc RADIUS_MM DEGREES       (positive turns left)
+ *
+ * and ends at the station marker, where docking takes over at cruise speed.
+ * The speed at every mm is bounded by lateral grip, the outer wheel's top
+ * speed, the steering headroom left in the pattern duties, the sensor
+ * frame spacing and how far the line can drift between control updates.
+ * A forward pass then limits acceleration and a backward pass braking,
+ * both by wheel traction less what the turn is using. The time along that
+ * profile is a lower bound for the route, printed to stderr with the time
+ * the quantized table gives and the time at cruise.
+ *
+ * Build: cc -O2 -Iheaders -Isim -o plan_speed tools/plan_speed.c -lm
+ * Usage: plan_speed route.track [a_lateral] [a_wheel] > src/speed_table.c
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <sample_rates.h>
+#include <speed_profile.h>
+#include <sim.h>
+
+#define TMR1_HZ 500000.0f       // as clock.h
+#define FRAME_MM 2.0f           // as sample_rates.c
+#define FRAME_CONVERSIONS 6     // as sample_rates.c
+#define ROUTE_MAX_MM 30000      // longest route planned, 1 mm resolution
+#define A_LATERAL 1500.0f       // mm/s^2, placeholder, grip in a turn
+#define A_WHEEL 800.0f          // mm/s^2, placeholder, traction along the line
+#define WHEEL_TOP_SPEED (100 * SIM_MM_S_PER_DUTY)   // mm/s at full duty
+#define STEER_HEADROOM 2        // widest pattern duty over the center duty
+#define DRIFT_MM 9.5f           // half the line, drift allowed per update
+
+static float curvature[ROUTE_MAX_MM];
+static float speed[ROUTE_MAX_MM + 1];
+
+static int read_route(FILE *file){
+    // Fills curvature, 1/mm positive to the left, returns the length in mm
+    char text[128];
+    int length = 0;
+    
+    while (fgets(text, sizeof(text), file)){
+        float a, b;
+        float k = 0;
+        int mm;
+        
+        if (text[0] == '#' || text[0] == '\n'){
+            continue;
+        }
+        
+        if (sscanf(text, "straight %f", &a) == 1 && a > 0){
+            mm = (int)(a + 0.5f);
+        }
+        
+        else if (sscanf(text, "arc %f %f", &a, &b) == 2 && a > 0){
+            mm = (int)(a * fabsf(b) * 3.1415927f / 180 + 0.5f);
+            k = b < 0 ? -1 / a : 1 / a;
+        }
+        
+        else {
+            fprintf(stderr, "bad route line: %s", text);
+            return -1;
+        }
+        
+        for (int i = 0; i < mm && length < ROUTE_MAX_MM; ++i){
+            curvature[length++] = k;
+        }
+    }
+    
+    return length;
+}
+
+static float speed_limit(float k, float a_lateral){
+    // Highest speed the turn and the sensing allow, mm/s
+    float half_base = fabsf(k) * SIM_WHEEL_BASE / 2;
+    float limit = STEER_HEADROOM * CRUISE_SPEED;
+    float control_s = CONTROL_PERIOD_MIN / TMR1_HZ;
+    
+    limit = fminf(limit, WHEEL_TOP_SPEED / (1 + half_base));
+    limit = fminf(limit, FRAME_MM * TMR1_HZ /
+            (FRAME_CONVERSIONS * SCAN_PERIOD_MIN));
+    
+    if (k != 0){
+        limit = fminf(limit, sqrtf(a_lateral / fabsf(k)));
+        limit = fminf(limit, sqrtf(2 * DRIFT_MM /
+                (fabsf(k) * control_s * control_s)));
+    }
+    
+    return limit;
+}
+
+static float traction(float v, float k, float a_lateral, float a_wheel){
+    // Acceleration along the line left over from the turn, friction ellipse
+    float used = v * v * fabsf(k) / a_lateral;
+    float left = used < 1 ? sqrtf(1 - used * used) : 0;
+    
+    return a_wheel * left / (1 + fabsf(k) * SIM_WHEEL_BASE / 2);
+}
+
+int main(int argc, char *argv[]){
+    FILE *file = argc > 1 ? fopen(argv[1], "r") : 0;
+    float a_lateral = argc > 2 ? (float)atof(argv[2]) : A_LATERAL;
+    float a_wheel = argc > 3 ? (float)atof(argv[3]) : A_WHEEL;
+    int length = file ? read_route(file) : -1;
+    
+    if (file){
+        fclose(file);
+    }
+    
+    if (length <= 0 || a_lateral <= 0 || a_wheel <= 0){
+        fprintf(stderr, "usage: plan_speed route.track [a_lateral] "
+                "[a_wheel]\n");
+        return 1;
+    }
+    
+    for (int i = 0; i < length; ++i){
+        speed[i] = speed_limit(curvature[i], a_lateral);
+    }
+    
+    speed[length] = fminf(CRUISE_SPEED, speed[length - 1]);
+    
+    // Accelerate from rest as hard as traction allows
+    speed[0] = 0;
+    
+    for (int i = 0; i < length; ++i){
+        float v = speed[i];
+        float a = traction(v, curvature[i], a_lateral, a_wheel);
+        
+        speed[i + 1] = fminf(speed[i + 1], sqrtf(v * v + 2 * a));
+    }
+    
+    // Brake as late as traction allows, into every turn and the marker
+    for (int i = length - 1; i >= 0; --i){
+        float v = speed[i + 1];
+        float a = traction(v, curvature[i], a_lateral, a_wheel);
+        
+        speed[i] = fminf(speed[i], sqrtf(v * v + 2 * a));
+    }
+    
+    /*
+    Each entry is the lowest planned speed over its step, so following the
+    table never exceeds the plan. The first entries are raised to
+    PROFILE_SPEED_MIN or the robot would never move off the start.
+    */
+    int entries = (length + PROFILE_STEP_MM - 1) / PROFILE_STEP_MM;
+    double best_s = 0;
+    double table_s = 0;
+    
+    printf("/*\n * File:   speed_table.c\n * Author: Jack\n *\n"
+           " * Generated by tools/plan_speed.c from %s,\n * a_lateral %.0f "
+           "mm/s^2, a_wheel %.0f mm/s^2. Replan rather than edit.\n */\n\n"
+           "#include <speed_profile.h>\n\n"
+           "const unsigned char speed_table[] = {", argv[1], a_lateral,
+           a_wheel);
+    
+    for (int e = 0; e < entries; ++e){
+        float low = speed[e * PROFILE_STEP_MM];
+        
+        for (int i = e * PROFILE_STEP_MM;
+                i < (e + 1) * PROFILE_STEP_MM && i <= length; ++i){
+            low = fminf(low, speed[i]);
+        }
+        
+        int count = (int)(low / PROFILE_SPEED_UNIT);
+        
+        if (count < PROFILE_SPEED_MIN / PROFILE_SPEED_UNIT){
+            count = PROFILE_SPEED_MIN / PROFILE_SPEED_UNIT;
+        }
+        
+        if (count > 255){
+            count = 255;
+        }
+        
+        for (int i = e * PROFILE_STEP_MM;
+                i < (e + 1) * PROFILE_STEP_MM && i < length; ++i){
+            table_s += 1.0 / (count * PROFILE_SPEED_UNIT);
+        }
+        
+        printf("%s%s%3d", e ? "," : "", e % 12 ? " " : "\n    ", count);
+    }
+    
+    printf("\n};\n\nconst unsigned short speed_table_length = %d;\n",
+            entries);
+    
+    for (int i = 0; i < length; ++i){
+        float v = (speed[i] + speed[i + 1]) / 2;
+        
+        // The first mm from rest, at the speed the forward pass reaches
+        best_s += 1.0 / (v > 0 ? v : speed[1]);
+    }
+    
+    fprintf(stderr, "route %d mm, %d entries\n", length, entries);
+    fprintf(stderr, "minimum time     %.2f s\n", best_s);
+    fprintf(stderr, "following table  %.2f s\n", table_s);
+    fprintf(stderr, "cruise           %.2f s\n",
+            (double)length / CRUISE_SPEED);
+    
+    return 0;
+}
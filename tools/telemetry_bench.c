@@ -0,0 +1,199 @@
+/*
+ * File:   telemetry_bench.c
+ * Author: Jack
+ *
+ * Created on December 21, 2020, 3:40 PM
+ *
+ * Host tool. Runs the telemetry codec over a synthetic run shaped like the
+ * robot's own records (line following at cruise speed, sensor noise, a
+ * marker at the end) and reports bytes per record against the raw and hex
+ * forms, encode and decode cost per record, and records per second at the
+ * UART's baud rate. Every record is decoded back and compared, and a copy
+ * of the stream with bytes dropped checks that the decoder resyncs and
+ * that every record it still returns matches the one sent.
+ *
+ * Cycles are host cycles from the TSC on x86 and only rank changes to the
+ * codec. They vary by host: about 600 to encode and 310 to decode a record
+ * here, others have seen 1650 and 1450.
+ *
+ * The PIC cost has not been measured; it has to be read from the XC8
+ * listing or a simulator. Counted on this run, a delta record takes 46
+ * put_bits() iterations, 31 rice_k() iterations and about 320 one bit
+ * shifts, as XC8 loops variable shifts. At rough PIC18 instruction costs
+ * that is some 6000 cycles, 1.5ms at 4 MIPS, or 7% of the CPU at the
+ * fastest CONTROL timestep, before the 0.7ms putch() waits on the UART.
+ *
+ * Build: cc -O2 -Iheaders -o telemetry_bench tools/telemetry_bench.c
+ *            src/telemetry_codec.c src/crc.c
+ * Usage: telemetry_bench [records]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <telemetry_codec.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define CYCLES() __rdtsc()
+#else
+#define CYCLES() 0ULL
+#endif
+
+#define BAUD_BYTES 11428        // 114286 baud, 10 bits per byte
+#define RAW_BYTES (2 * TELEMETRY_CHANNELS)
+#define CONTROL_TICKS 20000     // 40ms at cruise, see sample_rates.h
+#define DROP_EVERY 997          // bytes between drops in the resync check
+#define WRONG_PER_DROP 64       // drops allowed per wrong record; the 8 bit
+                                // check passes 1 in 256 corrupted records
+
+static double now(void){
+    struct timespec t;
+    
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + t.tv_nsec * 1e-9;
+}
+
+static short noise(int amplitude){
+    return (short)(rand() % (2 * amplitude + 1) - amplitude);
+}
+
+static void make_records(short *records, long count){
+    /*
+    Sensor readings swing as the line drifts under the array, encoder
+    counts climb at about 250 mm/s with the wheels trading speed while
+    steering, and the last few records sit on the stop marker.
+    */
+    unsigned long ticks = 0;
+    int right = 0;
+    int left = 0;
+    int drift = 0;
+    
+    for (long i = 0; i < count; ++i){
+        short *v = records + i * TELEMETRY_CHANNELS;
+        char marker = i > count - 20;
+        
+        drift += noise(3);
+        drift = drift > 40 ? 40 : drift < -40 ? -40 : drift;
+        ticks += CONTROL_TICKS + noise(200);
+        right += 36 + drift / 10 + noise(1);
+        left += 36 - drift / 10 + noise(1);
+        
+        v[0] = (short)(ticks >> 9);
+        v[1] = (short)(marker ? 3800 : 600 + 40 * (drift > 0 ? drift : 0)) + 
+                noise(8);
+        v[2] = (short)(3700 - 20 * abs(drift)) + noise(8);
+        v[3] = (short)(marker ? 3800 : 600 + 40 * (drift < 0 ? -drift : 0)) + 
+                noise(8);
+        v[4] = (short)right;
+        v[5] = (short)left;
+        v[6] = (short)(250 + noise(15));
+        v[7] = marker ? 7 : drift > 15 ? 3 : drift < -15 ? 6 : 2;
+    }
+}
+
+int main(int argc, char *argv[]){
+    long count = argc > 1 ? atol(argv[1]) : 100000;
+    short *records = malloc(count * TELEMETRY_CHANNELS * sizeof(short));
+    unsigned char *stream = malloc(count * TELEMETRY_RECORD_MAX);
+    unsigned long *ends = malloc(count * sizeof(unsigned long));
+    struct TelemetryEncoder encoder;
+    struct TelemetryDecoder decoder;
+    unsigned long length = 0;
+    long decoded = 0;
+    long mismatches = 0;
+    
+    if (count < 2 || records == 0 || stream == 0 || ends == 0){
+        fprintf(stderr, "usage: telemetry_bench [records >= 2]\n");
+        return 1;
+    }
+    
+    srand(1);
+    make_records(records, count);
+    reset_telemetry_encoder(&encoder);
+    
+    double start = now();
+    unsigned long long cycles = CYCLES();
+    
+    for (long i = 0; i < count; ++i){
+        length += encode_telemetry(&encoder, records + i * TELEMETRY_CHANNELS, 
+                stream + length);
+        ends[i] = length - 1;
+    }
+    
+    double encode_s = now() - start;
+    unsigned long long encode_cycles = CYCLES() - cycles;
+    
+    reset_telemetry_decoder(&decoder);
+    start = now();
+    cycles = CYCLES();
+    
+    for (unsigned long i = 0; i < length; ++i){
+        if (decode_telemetry_byte(&decoder, stream[i])){
+            if (memcmp(decoder.values, records + decoded * TELEMETRY_CHANNELS,
+                    sizeof(decoder.values)) != 0){
+                ++mismatches;
+            }
+            
+            ++decoded;
+        }
+    }
+    
+    double decode_s = now() - start;
+    unsigned long long decode_cycles = CYCLES() - cycles;
+    
+    /*
+    Same stream with a byte lost now and then, as from a UART overrun. A
+    record the decoder returns ends on the last byte of the one sent there,
+    or the stream has slipped, and its values must match.
+    */
+    long recovered = 0;
+    long wrong = 0;
+    long source = 0;
+    reset_telemetry_decoder(&decoder);
+    
+    for (unsigned long i = 0; i < length; ++i){
+        if (i % DROP_EVERY == DROP_EVERY - 1 || 
+                !decode_telemetry_byte(&decoder, stream[i])){
+            continue;
+        }
+        
+        while (ends[source] < i){
+            ++source;
+        }
+        
+        if (ends[source] != i || memcmp(decoder.values, 
+                records + source * TELEMETRY_CHANNELS, 
+                sizeof(decoder.values)) != 0){
+            ++wrong;
+        }
+        
+        ++recovered;
+    }
+    
+    double per_record = (double)length / count;
+    
+    printf("records            %ld\n", count);
+    printf("bytes per record   %.2f (raw %d, hex text %d)\n", per_record, 
+            RAW_BYTES, 2 * RAW_BYTES + 4);
+    printf("compression        %.2fx over raw\n", RAW_BYTES / per_record);
+    printf("records per second %.0f at 115200 baud (raw %d)\n", 
+            BAUD_BYTES / per_record, BAUD_BYTES / RAW_BYTES);
+    printf("encode             %.1f ns, %.0f cycles per record\n", 
+            encode_s * 1e9 / count, (double)encode_cycles / count);
+    printf("decode             %.1f ns, %.0f cycles per record\n", 
+            decode_s * 1e9 / count, (double)decode_cycles / count);
+    printf("round trip         %ld of %ld records, %ld mismatched\n", 
+            decoded, count, mismatches);
+    printf("with drops         %lu dropped, %ld records, %lu resyncs, "
+           "%ld wrong\n", length / DROP_EVERY, recovered, decoder.errors, 
+           wrong);
+    
+    free(records);
+    free(stream);
+    free(ends);
+    
+    return decoded == count && mismatches == 0 && 
+            wrong * WRONG_PER_DROP <= (long)(length / DROP_EVERY) ? 0 : 1;
+}
@@ -0,0 +1,121 @@
+/*
+ * File:   trace2json.c
+ * Author: Jack
+ *
+ * Created on December 20, 2020, 3:30 PM
+ *
+ * Host tool. Converts the event trace dumped by the robot when it receives
+ * 'T' on the UART (see trace.h) into Chrome trace JSON, which opens in
+ * chrome://tracing or ui.perfetto.dev.
+ *
+ * Build: cc -Iheaders -o trace2json tools/trace2json.c
+ * Usage: trace2json < dump.txt > trace.json
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <trace.h>
+
+#define TICK_US 2               // TMR1 at 500 kHz
+
+// Same order as tasks[] in main.c
+static const char *task_names[] = {"button", "measurement", "scan", "control",
+        "abort", "commands", "display", "scan_rates", "telemetry",
+        "freq_report", "sequence"};
+static const char *isr_names[] = {"LoPriISR", "HiPriISR"};
+static const char *state_names[] = {"", "go", "dock", "shed", "encoder",
+                                    "loss"};
+
+#define TASK_NAMES (sizeof(task_names) / sizeof(task_names[0]))
+
+static char first = 1;
+
+static void event(const char *name, const char *phase, unsigned long time,
+        int thread){
+    printf("%s\n{\"name\":\"%s\",\"ph\":\"%s\",\"ts\":%lu,\"pid\":1,"
+           "\"tid\":%d", first ? "" : ",", name, phase, time * TICK_US, thread);
+    first = 0;
+}
+
+int main(void){
+    char line[64];
+    char name[32];
+    unsigned long high = 0;
+    unsigned int last = 0;
+    unsigned long records = 0;
+    
+    printf("{\"displayTimeUnit\":\"ms\",\"traceEvents\":[");
+    
+    while (fgets(line, sizeof(line), stdin)){
+        unsigned int type, id, low, high_byte;
+        
+        if (strncmp(line, "T ", 2) != 0 || sscanf(line + 2, "%2x%2x%2x%2x", 
+                &type, &id, &low, &high_byte) != 4){
+            continue;
+        }
+        
+        /*
+        Timestamps are 16-bit TMR1 and wrap every 131 ms. Every wrap raises
+        the TMR1 overflow interrupt, so the LoPriISR entry right after it is
+        always in the trace and a time going backwards means one wrap.
+        */
+        unsigned int time = low | (high_byte << 8);
+        
+        if (records != 0 && time < last){
+            high += 0x10000;
+        }
+        
+        last = time;
+        ++records;
+        
+        unsigned long now = high + time;
+        
+        switch (type){
+            case TRACE_ISR_ENTER:
+            case TRACE_ISR_EXIT:
+                event(isr_names[id & 1], type == TRACE_ISR_ENTER ? "B" : "E",
+                        now, 2 + (id & 1));
+                printf("}");
+                break;
+                
+            case TRACE_TASK_START:
+            case TRACE_TASK_STOP:
+                if (id < TASK_NAMES){
+                    snprintf(name, sizeof(name), "%s", task_names[id]);
+                }
+                
+                else {
+                    snprintf(name, sizeof(name), "task %u", id);
+                }
+                
+                event(name, type == TRACE_TASK_START ? "B" : "E", now, 1);
+                printf("}");
+                break;
+                
+            case TRACE_STATE:
+                if ((id >> 4) < sizeof(state_names) / sizeof(state_names[0])){
+                    snprintf(name, sizeof(name), "%s", state_names[id >> 4]);
+                }
+                
+                else {
+                    snprintf(name, sizeof(name), "state %u", id >> 4);
+                }
+                
+                event(name, "i", now, 1);
+                printf(",\"s\":\"g\",\"args\":{\"value\":%u}}", id & 0x0F);
+                break;
+                
+            case TRACE_MARK:
+                snprintf(name, sizeof(name), "mark %u", id);
+                event(name, "i", now, 1);
+                printf(",\"s\":\"t\"}");
+                break;
+        }
+    }
+    
+    printf("\n]}\n");
+    fprintf(stderr, "%lu records, %.1f ms\n", records, 
+            (high + last) * TICK_US / 1000.0);
+    
+    return 0;
+}